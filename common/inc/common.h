@@ -6,6 +6,7 @@
 #define __COMMON_H__
 
 #include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /* #define STATS_ON */
@@ -18,18 +19,38 @@
 #define MAX_DPU_RESULTS (1 << 20)
 #define MAX_RESULTS_PER_READ (1 << 10)
 
-#define SIZE_READ 120
+/*
+ * The size of the reads is chosen when creating the index. The DPU program is built once for each supported size
+ * (SIZE_READ is then defined on the command line), while the host reads it from the index header.
+ */
+#define SIZE_READ_MAX 150
 #define SIZE_SEED 14
-#define SIZE_NEIGHBOUR_IN_BYTES ((SIZE_READ - SIZE_SEED) / 4)
+#define SIZE_NEIGHBOUR_IN_BYTES_OF(size_read) (((size_read) - SIZE_SEED) / 4)
 #define DELTA_NEIGHBOUR(round) ((SIZE_SEED * round) / 4)
-#define SIZE_IN_SYMBOLS(delta) ((SIZE_NEIGHBOUR_IN_BYTES - delta) * 4)
+#define SIZE_IN_SYMBOLS_OF(size_read, delta) ((SIZE_NEIGHBOUR_IN_BYTES_OF(size_read) - delta) * 4)
+
+#ifdef SIZE_READ
+#define SIZE_NEIGHBOUR_IN_BYTES SIZE_NEIGHBOUR_IN_BYTES_OF(SIZE_READ)
+#define SIZE_IN_SYMBOLS(delta) SIZE_IN_SYMBOLS_OF(SIZE_READ, delta)
+#define NBR_ARRAY_SIZE(size) (size)
+#else
+/* On the host, the neighbours have the size of the index: see DPU_REQUEST_SIZE and COORDS_AND_NBR_SIZE */
+#define NBR_ARRAY_SIZE(size)
+#endif
 
 /**
  * @brief A snapshot of the MRAM.
  *
- * @var delta           Delta to apply to nodp and odpd comparison depending on the round.
+ * The MRAM can hold two banks of the index, so that the index of the next run is loaded while the DPU works on the
+ * current one.
+ *
+ * @var delta         Delta to apply to nodp and odpd comparison depending on the round.
+ * @var bank_offset   Offset in bytes, from the beginning of the MRAM heap, of the bank of the index used by the run.
  */
-typedef uint32_t delta_info_t;
+typedef struct {
+    uint32_t delta;
+    uint32_t bank_offset;
+} mram_info_t;
 #define DPU_MRAM_INFO_VAR m_mram_info
 
 /**
@@ -110,13 +131,31 @@ typedef struct {
     uint32_t offset;
     uint32_t count;
     uint32_t num;
-    uint8_t nbr[SIZE_NEIGHBOUR_IN_BYTES];
+    uint8_t nbr[NBR_ARRAY_SIZE(SIZE_NEIGHBOUR_IN_BYTES)];
 } dpu_request_t;
 #define DPU_REQUEST_VAR m_dpu_request
+#define DPU_REQUEST_SIZE(size_read) ((offsetof(dpu_request_t, nbr) + SIZE_NEIGHBOUR_IN_BYTES_OF(size_read) + 3) & ~3)
 
 typedef struct {
     dpu_result_coord_t coord;
-    uint8_t nbr[ALIGN_DPU(SIZE_NEIGHBOUR_IN_BYTES)];
+    uint8_t nbr[NBR_ARRAY_SIZE(ALIGN_DPU(SIZE_NEIGHBOUR_IN_BYTES))];
 } coords_and_nbr_t;
+#define COORDS_AND_NBR_SIZE(size_read) (sizeof(dpu_result_coord_t) + ALIGN_DPU(SIZE_NEIGHBOUR_IN_BYTES_OF(size_read)))
+
+/**
+ * @brief Size of each area reserved in MRAM by the DPU program. The index is stored in the MRAM heap, after all of them:
+ * every "__mram_noinit" variable of the DPU program must be listed here and checked against its declaration.
+ */
+#define MRAM_SIZE_REQUEST(size_read) (MAX_DPU_REQUEST * DPU_REQUEST_SIZE(size_read))
+#define MRAM_SIZE_RESULT (MAX_DPU_RESULTS * sizeof(dpu_result_out_t))
+#define MRAM_SIZE_SWAP_RESULT (NR_TASKLETS * MAX_RESULTS_PER_READ * sizeof(dpu_result_out_t))
+#define MRAM_SIZE_TASKLET_STATS (NR_TASKLETS * sizeof(dpu_tasklet_stats_t))
+#define MRAM_SIZE_RESERVED(size_read)                                                                                            \
+    (MRAM_SIZE_REQUEST(size_read) + MRAM_SIZE_RESULT + MRAM_SIZE_SWAP_RESULT + MRAM_SIZE_TASKLET_STATS)
+
+#ifdef SIZE_READ
+_Static_assert(sizeof(dpu_request_t) == DPU_REQUEST_SIZE(SIZE_READ), "dpu_request_t does not match DPU_REQUEST_SIZE");
+_Static_assert(sizeof(coords_and_nbr_t) == COORDS_AND_NBR_SIZE(SIZE_READ), "coords_and_nbr_t does not match COORDS_AND_NBR_SIZE");
+#endif
 
 #endif /* __COMMON_H__ */
@@ -11,6 +11,7 @@
 #include "stats.h"
 
 __mram_noinit dpu_result_out_t m_dpu_swap_result[NR_TASKLETS * MAX_RESULTS_PER_READ];
+_Static_assert(sizeof(m_dpu_swap_result) == MRAM_SIZE_SWAP_RESULT, "m_dpu_swap_result does not match MRAM_SIZE_SWAP_RESULT");
 
 void dout_clear(dout_t *dout)
 {
@@ -34,6 +34,7 @@ typedef struct {
 __host nb_request_t DPU_NB_REQUEST_VAR;
 
 __mram_noinit dpu_request_t DPU_REQUEST_VAR[MAX_DPU_REQUEST];
+_Static_assert(sizeof(DPU_REQUEST_VAR) == MRAM_SIZE_REQUEST(SIZE_READ), "DPU_REQUEST_VAR does not match MRAM_SIZE_REQUEST");
 
 /**
  * @brief Common request pool, shared by every tasklet.
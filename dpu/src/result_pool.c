@@ -39,6 +39,7 @@ MUTEX_INIT(result_pool_mutex);
  * @brief The buffer of result in mram.
  */
 __mram_noinit dpu_result_out_t DPU_RESULT_VAR[MAX_DPU_RESULTS];
+_Static_assert(sizeof(DPU_RESULT_VAR) == MRAM_SIZE_RESULT, "DPU_RESULT_VAR does not match MRAM_SIZE_RESULT");
 
 void result_pool_init()
 {
@@ -32,12 +32,14 @@ STDOUT_BUFFER_INIT(128 * 1024);
  * Information are gathered by the first tasklet during boot and used by other tasklets
  * to get the memory topology.
  */
-__host delta_info_t DPU_MRAM_INFO_VAR;
+__host mram_info_t DPU_MRAM_INFO_VAR;
 
 /**
  * @brief The statistic of each tasklet in the mram.
  */
 __mram_noinit dpu_tasklet_stats_t DPU_TASKLET_STATS_VAR[NR_TASKLETS];
+_Static_assert(
+    sizeof(DPU_TASKLET_STATS_VAR) == MRAM_SIZE_TASKLET_STATS, "DPU_TASKLET_STATS_VAR does not match MRAM_SIZE_TASKLET_STATS");
 #ifdef STATS_ON
 #define DPU_TASKLET_STATS_WRITE(res, addr)                                                                                       \
     do {                                                                                                                         \
@@ -88,7 +90,8 @@ static void load_reference_multiple_nbr_and_coords_at(
     /* The input starts with coordinates (8 bytes), followed by the neighbour. Structure is aligned
      * on 8 bytes boundary.
      */
-    uintptr_t coords_nbr_address = ((uintptr_t)DPU_MRAM_HEAP_POINTER + (base + idx) * sizeof(coords_and_nbr_t));
+    uintptr_t coords_nbr_address
+        = ((uintptr_t)DPU_MRAM_HEAP_POINTER + DPU_MRAM_INFO_VAR.bank_offset + (base + idx) * sizeof(coords_and_nbr_t));
     unsigned int coords_nbr_len_total = sizeof(coords_and_nbr_t) * NB_REF_PER_READ;
     ASSERT_DMA_ADDR(coords_nbr_address, cache, coords_nbr_len_total);
     ASSERT_DMA_LEN(coords_nbr_len_total);
@@ -115,7 +118,7 @@ static void compare_neighbours(sysname_t tasklet_id, uint32_t *mini, coords_and_
 
     STATS_GET_START_TIME(start, acc, end);
 
-    score = score_nodp = nodp(current_read_nbr, ref_nbr, *mini, SIZE_NEIGHBOUR_IN_BYTES - DPU_MRAM_INFO_VAR);
+    score = score_nodp = nodp(current_read_nbr, ref_nbr, *mini, SIZE_NEIGHBOUR_IN_BYTES - DPU_MRAM_INFO_VAR.delta);
 
     STATS_GET_END_TIME(end, acc);
     STATS_STORE_NODP_TIME(tasklet_stats, (end + acc - start));
@@ -124,7 +127,8 @@ static void compare_neighbours(sysname_t tasklet_id, uint32_t *mini, coords_and_
     if (score_nodp == UINT_MAX) {
         STATS_GET_START_TIME(start, acc, end);
 
-        score_odpd = score = odpd(current_read_nbr, ref_nbr, *mini, NB_BYTES_TO_SYMS(SIZE_NEIGHBOUR_IN_BYTES, DPU_MRAM_INFO_VAR));
+        score_odpd = score
+            = odpd(current_read_nbr, ref_nbr, *mini, NB_BYTES_TO_SYMS(SIZE_NEIGHBOUR_IN_BYTES, DPU_MRAM_INFO_VAR.delta));
 
         STATS_GET_END_TIME(end, acc);
         STATS_STORE_ODPD_TIME(tasklet_stats, (end + acc - start));
@@ -231,7 +235,7 @@ int main()
         request_pool_init();
         result_pool_init();
 
-        if (((NB_BYTES_TO_SYMS(SIZE_NEIGHBOUR_IN_BYTES, DPU_MRAM_INFO_VAR) + 2) * 3 * 16) >= 0x10000) {
+        if (((NB_BYTES_TO_SYMS(SIZE_NEIGHBOUR_IN_BYTES, DPU_MRAM_INFO_VAR.delta) + 2) * 3 * 16) >= 0x10000) {
             printf("cannot run code: symbol length is larger than mulub operation\n");
             halt();
         }
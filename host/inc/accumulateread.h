@@ -7,12 +7,25 @@
 
 #include "common.h"
 
+/**
+ * @brief Results of a DPU for a pass, ended by a result with num = -1.
+ *
+ * @var nb_res      The number of results.
+ * @var max_nb_res  The number of results that fit in "results" (end mark included).
+ * @var results     The results.
+ */
 typedef struct {
     nb_result_t nb_res;
+    nb_result_t max_nb_res;
     dpu_result_out_t *results;
 } acc_results_t;
 
 acc_results_t *accumulate_get_buffer(unsigned int dpu_id, unsigned int pass_id);
+
+/**
+ * @brief Make the buffer of a DPU big enough for the results of "nb_launch" launches (see dispatch_nb_launch).
+ */
+acc_results_t *accumulate_reserve_buffer(unsigned int dpu_id, unsigned int pass_id, unsigned int nb_launch);
 acc_results_t accumulate_get_result(unsigned int pass_id);
 
 void accumulate_read(unsigned int pass_id, unsigned int dpu_offset);
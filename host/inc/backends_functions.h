@@ -12,9 +12,10 @@
  */
 typedef struct backends_functions_struct {
     void (*run_dpu)(unsigned int, unsigned int, sem_t *, sem_t *, sem_t *, sem_t *);
-    void (*init_backend)(unsigned int *);
+    void (*init_backend)(unsigned int *, unsigned int *);
     void (*free_backend)(void);
-    void (*load_mram)(unsigned int, int);
+    void (*load_mram)(unsigned int, unsigned int);
+    void (*select_mram)(unsigned int, int);
     void (*wait_dpu)(void);
 } backends_functions_t;
 
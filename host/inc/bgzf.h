@@ -0,0 +1,37 @@
+/**
+ * Copyright 2016-2019 - Dominique Lavenier & UPMEM
+ */
+
+#ifndef __BGZF_H__
+#define __BGZF_H__
+
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * @brief Compressed input file.
+ *
+ * BGZF files (the blocked gzip produced by bgzip/samtools) are inflated by a pool of threads, one batch of blocks ahead of
+ * the reader. Other gzip files are inflated as a single stream.
+ */
+typedef struct bgzf_file bgzf_file_t;
+
+/**
+ * @brief Open "f" as a compressed file.
+ *
+ * @return NULL if "f" is not gzip compressed.
+ */
+bgzf_file_t *bgzf_open(FILE *f);
+
+/**
+ * @brief Read up to "size" uncompressed bytes into "buffer".
+ *
+ * @return The number of bytes read, 0 at the end of the file.
+ */
+size_t bgzf_read(bgzf_file_t *bf, char *buffer, size_t size);
+
+void bgzf_rewind(bgzf_file_t *bf);
+
+void bgzf_close(bgzf_file_t *bf);
+
+#endif /* __BGZF_H__ */
@@ -10,18 +10,60 @@
 /**
  * @brief List of reads dispatched to a DPU.
  *
- * @var nb_reads  The number of requests.
- * @var reads     A table of nb_reads requests. Since the read size is not fixed, the table is a raw byte stream.
+ * A DPU can receive more than MAX_DPU_REQUEST requests in a pass, in which case they are sent to it in several launches
+ * (see dispatch_nb_launch).
+ *
+ * @var nb_reads      The number of requests.
+ * @var max_reads     The number of requests that fit in dpu_requests.
+ * @var dpu_requests  A table of nb_reads requests. Since the read size is not fixed, the table is a raw byte stream.
  */
 typedef struct {
     nb_request_t nb_reads;
+    nb_request_t max_reads;
     dpu_request_t *dpu_requests;
 } dispatch_request_t;
 
+/**
+ * @brief Number of launches needed by a DPU to handle "nb_reads" requests, at most MAX_DPU_REQUEST per launch.
+ */
+static inline unsigned int dispatch_nb_launch(nb_request_t nb_reads)
+{
+    return nb_reads == 0 ? 1 : (nb_reads + MAX_DPU_REQUEST - 1) / MAX_DPU_REQUEST;
+}
+
+/**
+ * @brief Number of requests sent to a DPU during its launch "launch_id".
+ */
+static inline nb_request_t dispatch_nb_reads_in_launch(dispatch_request_t *requests, unsigned int launch_id)
+{
+    nb_request_t first_read = launch_id * MAX_DPU_REQUEST;
+    if (requests->nb_reads <= first_read) {
+        return 0;
+    }
+    return requests->nb_reads - first_read < MAX_DPU_REQUEST ? requests->nb_reads - first_read : MAX_DPU_REQUEST;
+}
+
+/**
+ * @brief Get a request of the list, each request being DPU_REQUEST_SIZE(size_read) bytes long.
+ */
+static inline dpu_request_t *dispatch_get_request(dispatch_request_t *requests, unsigned int idx, const unsigned int size_read)
+{
+    return (dpu_request_t *)((uint8_t *)requests->dpu_requests + (size_t)idx * DPU_REQUEST_SIZE(size_read));
+}
+
 dispatch_request_t *dispatch_get(unsigned int dpu_id, unsigned int pass_id);
 
 void dispatch_read(unsigned int pass_id);
 
+/**
+ * @brief Get the number of reads to put in the pass "pass_id".
+ *
+ * The size is scaled from the cost of the pass dispatched NB_READS_BUFFER passes before, so that the most loaded DPU stays
+ * within one launch (MAX_DPU_REQUEST requests) and within the work budget, and the requests within the memory budget (see
+ * get_work_budget and get_memory_budget). It is at most MAX_READS_BUFFER, and each new size is printed.
+ */
+unsigned int dispatch_get_pass_size(unsigned int pass_id);
+
 void dispatch_init();
 void dispatch_free();
 
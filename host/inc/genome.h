@@ -5,23 +5,80 @@
 #ifndef __GENOME_H__
 #define __GENOME_H__
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #define MAX_SEQ_GEN (24) // max number of chromosomes
 #define MAX_SEQ_NAME_SIZE (8)
 
+/* Code of the bases that are not known ('N') */
+#define GENOME_CODE_N (4)
+/* Number of bases per bit of "n_blocks" */
+#define GENOME_N_BLOCK_SIZE (64)
+#define GENOME_BASES_PER_WORD (32)
+
+/**
+ * @brief Run of consecutive 'N' in the reference genome.
+ */
+typedef struct {
+    uint64_t start;
+    uint64_t len;
+} genome_n_run_t;
+
+/**
+ * @brief Reference genome.
+ *
+ * The bases are packed on 2 bits (A0 C1 T2 G3), GENOME_BASES_PER_WORD per word, the first base in the lowest bits. The 'N'
+ * are stored as 0 in "packed" and described by the sorted runs of "n_runs". A bit of "n_blocks" is set for each block of
+ * GENOME_N_BLOCK_SIZE bases that contains an 'N', so that the runs are only searched for those blocks.
+ *
+ * @var nb_bases       Number of bases of all the sequences, sequence i starting at base pt_seq[i].
+ * @var nb_n_runs      Number of runs of 'N'.
+ * @var packed_offset  Offset in the genome file of "packed" (same for "n_blocks" and "n_runs").
+ */
 typedef struct {
     uint32_t magic;
     uint32_t version;
     uint32_t nb_seq;
     uint64_t pt_seq[MAX_SEQ_GEN];
     uint64_t len_seq[MAX_SEQ_GEN];
-    uint64_t fasta_file_size;
+    uint64_t nb_bases;
     char seq_name[MAX_SEQ_GEN][MAX_SEQ_NAME_SIZE];
-    int8_t *data;
+    uint64_t nb_n_runs;
+    uint64_t packed_offset;
+    uint64_t n_blocks_offset;
+    uint64_t n_runs_offset;
+    uint64_t *packed;
+    uint64_t *n_blocks;
+    genome_n_run_t *n_runs;
     int32_t *mapping_coverage;
 } genome_t;
 
+/**
+ * @brief Whether a base of the reference genome, known to be in a block containing an 'N', is an 'N'.
+ */
+bool genome_is_n(genome_t *genome, uint64_t pos);
+
+/**
+ * @brief Get a base of the reference genome, GENOME_CODE_N for an 'N' or outside of the genome.
+ */
+static inline int8_t genome_get_base(genome_t *genome, uint64_t pos)
+{
+    if (pos >= genome->nb_bases) {
+        return GENOME_CODE_N;
+    }
+    uint64_t n_block = pos / GENOME_N_BLOCK_SIZE;
+    if (((genome->n_blocks[n_block / 64] >> (n_block % 64)) & 1) && genome_is_n(genome, pos)) {
+        return GENOME_CODE_N;
+    }
+    return (genome->packed[pos / GENOME_BASES_PER_WORD] >> ((pos % GENOME_BASES_PER_WORD) * 2)) & 3;
+}
+
+/**
+ * @brief Get "len" consecutive bases of the reference genome starting at "pos", as genome_get_base would.
+ */
+void genome_get_bases(genome_t *genome, uint64_t pos, unsigned int len, int8_t *bases);
+
 void genome_create();
 
 void genome_load();
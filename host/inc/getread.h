@@ -5,6 +5,7 @@
 #ifndef __GETREAD_H__
 #define __GETREAD_H__
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -12,8 +13,30 @@ int get_reads_in_buffer(unsigned int pass_id);
 
 int8_t *get_reads_buffer(unsigned int pass_id);
 
-void get_reads(FILE *fpe1, FILE *fpe2, unsigned int pass_id);
+/**
+ * @brief Map the PE1 and PE2 input files in memory so that get_reads can parse them in place.
+ *
+ * @param replay  Keep the reads parsed until the first call to get_reads_rewind in a packed cache (in RAM, or in a spill
+ *                file when it grows too large), and get the reads from this cache after it instead of parsing the input
+ *                files again.
+ */
+void get_reads_init(FILE *fpe1, FILE *fpe2, bool replay);
+
+/**
+ * @brief Restart the reading of the reads from the first one, either from the cache or from the beginning of the input
+ * files.
+ */
+void get_reads_rewind();
 
+void get_reads_free();
+
+void get_reads(unsigned int pass_id);
+
+/**
+ * @brief Get the size of the reads in "f" and an estimation of their number.
+ *
+ * @return 0 on success, 1 if "f" is a pipe or a compressed file (its reads are not counted beforehand), -1 on error.
+ */
 int get_input_info(FILE *f, size_t *read_size, size_t *nb_read);
 
 #endif /* __GETREAD_H__ */
@@ -8,29 +8,38 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
-#include <sys/queue.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
 
 /**
- * @brief Structure of a list of index of neighbour that shared the same seed.
+ * @brief Chunk of the neighbours that share the same seed, stored in one DPU.
+ *
+ * The index is stored as a compressed sparse row: the chunks of a seed are contiguous in the table of chunks, starting at
+ * the offset of the seed in the table of offsets (see index_get).
  *
  * @var nb_nbr   Number of neighbour.
  * @var offset   Address in the DPU memory of the first neighbour to compute.
  * @var num_dpu  DPU number where the reference seed that match has been dispatch.
- * @var next     Needed to have a linked-list of index.
  */
 typedef struct index_seed {
     uint32_t nb_nbr;
     uint32_t offset;
     uint32_t num_dpu;
-    struct index_seed *next;
 } index_seed_t;
 
-TAILQ_HEAD(distribute_index_list, distribute_index);
+/**
+ * @brief What has been given to a DPU when distributing the index between the DPUs.
+ *
+ * @var workload  Number of neighbours of the DPU weighted by the number of occurrences of their seed in the reference.
+ * @var size      Number of neighbours of the DPU.
+ * @var dpu_id    DPU number.
+ */
 typedef struct distribute_index {
     uint64_t workload;
     uint32_t size;
     uint32_t dpu_id;
-    TAILQ_ENTRY(distribute_index) entries;
 } distribute_index_t;
 
 char *get_index_folder();
@@ -43,11 +52,64 @@ void index_create_folder();
 
 void index_free();
 
-index_seed_t *index_get(int8_t *read);
+/**
+ * @brief Get the chunks of neighbours of the reference matching the seed of a read.
+ *
+ * @param read   The read.
+ * @param seeds  Output the first chunk.
+ *
+ * @return The number of chunks, which follow each other from "*seeds".
+ */
+unsigned int index_get(int8_t *read, index_seed_t **seeds);
+
+#define INDEX_BATCH_SIZE (32)
+
+/**
+ * @brief Get the chunks matching the seeds of a batch of reads.
+ *
+ * The codes of the seeds of the whole batch are computed first and their offsets in the index prefetched, then the offsets
+ * are read and the chunks prefetched, so that the cache misses of the batch overlap.
+ *
+ * @param reads     First read of the batch, read i starting at "reads + i * stride".
+ * @param stride    Distance between two reads of the batch.
+ * @param nb_read   Number of reads in the batch, at most INDEX_BATCH_SIZE.
+ * @param seeds     Output the first chunk of each read of the batch (see index_get).
+ * @param nb_seeds  Output the number of chunks of each read of the batch.
+ */
+void index_get_batch(int8_t *reads, size_t stride, unsigned int nb_read, index_seed_t **seeds, unsigned int *nb_seeds);
+
+/**
+ * @brief Measure the number of seeds looked up per second in the index, with index_get and with index_get_batch.
+ */
+void index_bench();
 
 unsigned int index_get_nb_dpu();
 
-void index_copy_neighbour(int8_t *dst, int8_t *src);
+/**
+ * @brief Get the size of the reads the index has been created for.
+ */
+unsigned int index_get_size_read();
+
+#define CODE_SIZE (4)
+#define CODE_MASK (CODE_SIZE - 1)
+
+/**
+ * @brief Pack the symbols of a neighbour, 4 symbols per byte.
+ */
+static inline void code_neighbour(int8_t *sequence, int8_t *code, const unsigned int size_neighbour_in_bytes)
+{
+    for (unsigned int i = 0; i < size_neighbour_in_bytes; i++) {
+        int j = i * 4;
+        code[i] = ((sequence[j + 3] & CODE_MASK) * (CODE_SIZE * CODE_SIZE * CODE_SIZE))
+            + ((sequence[j + 2] & CODE_MASK) * (CODE_SIZE * CODE_SIZE)) + ((sequence[j + 1] & CODE_MASK) * (CODE_SIZE))
+            + ((sequence[j] & CODE_MASK));
+    }
+}
+
+static inline void index_copy_neighbour(int8_t *dst, int8_t *src, const unsigned int size_neighbour_in_bytes)
+{
+    code_neighbour(&src[SIZE_SEED], dst, size_neighbour_in_bytes);
+}
 
 enum xfer_direction {
     xfer_read,
@@ -69,4 +131,42 @@ static inline void xfer_file(uint8_t *buffer, size_t size_to_xfer, FILE *f, enum
     }
 }
 
+/* Alignment of the sections of the index and genome files, so that they can be used directly from a mapping of the file */
+#define FILE_SECTION_ALIGNMENT (4096ULL)
+#define FILE_SECTION_ALIGN(offset) (((offset) + FILE_SECTION_ALIGNMENT - 1) & ~(FILE_SECTION_ALIGNMENT - 1))
+
+/**
+ * @brief Write zeros up to the beginning of the next aligned section of a file.
+ *
+ * @return The offset of the section in the file.
+ */
+static inline uint64_t xfer_file_align(FILE *f)
+{
+    static const uint8_t padding[FILE_SECTION_ALIGNMENT] = { 0 };
+    uint64_t offset = ftell(f);
+    uint64_t section_offset = FILE_SECTION_ALIGN(offset);
+    if (section_offset != offset) {
+        xfer_file((uint8_t *)padding, section_offset - offset, f, xfer_write);
+    }
+    return section_offset;
+}
+
+/**
+ * @brief Map a whole file read-only, so that its pages are shared with every process using the same file.
+ *
+ * @param f     The file.
+ * @param size  Output the size of the file (and of the mapping).
+ *
+ * @return The beginning of the mapping.
+ */
+static inline uint8_t *map_file(FILE *f, size_t *size)
+{
+    struct stat st;
+    assert(fstat(fileno(f), &st) == 0);
+    *size = (size_t)st.st_size;
+    void *data = mmap(NULL, *size, PROT_READ, MAP_SHARED, fileno(f), 0);
+    assert(data != MAP_FAILED);
+    return (uint8_t *)data;
+}
+
 #endif /* __INDEX_H__ */
@@ -10,16 +10,108 @@
  *
  * Defines the structures representing the DPU MRAMs on both the host and DPU side.
  */
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #include "common.h"
 #include "index.h"
 
-size_t mram_load(uint8_t **mram, unsigned int dpu_id);
+#define MRAM_NB_BANK_MAX (2)
+
+/**
+ * @brief Map the file containing the MRAM images of every DPU, once for the whole mapping.
+ */
+void mram_map();
+void mram_unmap();
+
+/**
+ * @brief Number of DPUs needed to map the index, once its virtual DPUs are packed (see get_nb_virtual_dpu_per_dpu).
+ *
+ * The DPUs used when mapping are numbered by this packing: DPU "dpu_id" holds the virtual DPUs of the index from
+ * dpu_id * mram_get_nb_slot().
+ */
+unsigned int mram_get_nb_dpu();
+
+/**
+ * @brief Number of virtual DPUs packed in the MRAM of each DPU.
+ */
+unsigned int mram_get_nb_slot();
+
+/**
+ * @brief Size in bytes of the slot of each virtual DPU in the MRAM of a DPU: the image in slot "n" starts at n times this size.
+ */
+uint32_t mram_get_slot_size();
+
+/**
+ * @brief Number of banks of the index in the MRAM (1 or MRAM_NB_BANK_MAX), each one holding the slots of the virtual DPUs of a run.
+ *
+ * When the index of a run takes less than half of the MRAM, the images of the next run are loaded in the other bank
+ * while the DPUs work on the current one.
+ */
+unsigned int mram_get_nb_bank();
+
+/**
+ * @brief Size in bytes of a bank of the index in the MRAM: the bank "n" starts at n times this size.
+ */
+uint32_t mram_get_bank_size();
+
+/**
+ * @brief Get the MRAM image of the slot "slot" of a DPU, directly in the mapped file (it must not be freed nor modified).
+ *
+ * At least mram_get_slot_size() bytes can be read from the returned pointer. It is NULL for the slots after the last
+ * virtual DPU.
+ *
+ * @return The size of the image.
+ */
+size_t mram_load(uint8_t **mram, unsigned int dpu_id, unsigned int slot);
+
+/**
+ * @brief Start reading, in the background, the MRAM images of the DPUs [first_dpu, first_dpu + nb_dpu) of the next run, so
+ * that loading them is only a transfer to the DPUs.
+ */
+void mram_prefetch(unsigned int first_dpu, unsigned int nb_dpu);
+
+/**
+ * @brief Wait for the end of the prefetch started last, if any.
+ *
+ * @param hidden_time  Output the time of the prefetch that was hidden behind the execution of the previous run, in seconds.
+ *
+ * @return Whether a prefetch was started.
+ */
+bool mram_prefetch_wait(double *hidden_time);
 
 void init_vmis(unsigned int nb_dpu, distribute_index_t *table);
 void free_vmis(unsigned int nb_dpu);
+
+/**
+ * @brief Allocate the MRAM images of the next group of DPUs, starting at "first_dpu".
+ *
+ * The group takes as many DPUs as possible while the size of their images stays under "memory_budget" bytes (0 for no
+ * limit), and at least one DPU. The DPUs used to help indexing all belong to the first group, and only count for the window
+ * of their image staged on the host.
+ *
+ * @return The first DPU after the group.
+ */
+unsigned int alloc_vmis_group(unsigned int first_dpu, unsigned long long memory_budget);
+
+/**
+ * @brief Push the staged window of the images of the DPUs used to help indexing to their MRAM, and move to the next window.
+ *
+ * @return Whether the reference genome needs to be walked again to fill the next window.
+ */
+bool flush_vmis_window();
+
+/**
+ * @brief Write the MRAM images of the current group of DPUs in the file containing them, in parallel, and free them.
+ */
+void write_vmis_group();
+
+/**
+ * @brief Whether the MRAM image of a DPU is part of the current group.
+ */
+bool vmi_in_group(unsigned int num_dpu);
+
 void write_vmi(unsigned int num_dpu, unsigned int num_ref, coords_and_nbr_t *coords_and_nbr);
 
 #endif /* __INTEGRATION_MDPU_H__ */
@@ -0,0 +1,25 @@
+/**
+ * Copyright 2016-2019 - Dominique Lavenier & UPMEM
+ */
+
+#ifndef __NUCLEOTIDE_H__
+#define __NUCLEOTIDE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Encode a line of nucleotides from ASCII: A -> 0, C -> 1, T -> 2, G -> 3 (that is "(c >> 1) & 3").
+ *
+ * Uses AVX2 or SSSE3 when the CPU supports it, scalar code otherwise.
+ *
+ * @param ascii   Nucleotides to encode.
+ * @param len     Number of nucleotides to encode.
+ * @param code    Output the encoded nucleotides.
+ * @param rev     If not NULL, output the reverse complement of "code" (rev[len - 1 - i] is the complement of code[i]).
+ * @param mask_n  Encode 'N' as 4 instead of its 2 bits code (used for the reference genome).
+ */
+void nucleotide_encode(const char *ascii, size_t len, int8_t *code, int8_t *rev, bool mask_n);
+
+#endif /* __NUCLEOTIDE_H__ */
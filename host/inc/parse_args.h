@@ -7,7 +7,7 @@
 
 #include <stdbool.h>
 
-typedef enum { goal_unknown, goal_index, goal_map } goal_t;
+typedef enum { goal_unknown, goal_index, goal_map, goal_bench } goal_t;
 
 /**
  * @brief Get the path where to store temporary and final file
@@ -36,6 +36,27 @@ unsigned int get_nb_thread_for_simu();
 
 bool get_index_with_dpus();
 
+/**
+ * @brief Get the size of the reads to create the index for.
+ */
+unsigned int get_size_read();
+
+/**
+ * @brief Get the maximum number of neighbours to compare on a DPU in a pass (0 if not limited).
+ */
+unsigned long long get_work_budget();
+
+/**
+ * @brief Get the maximum size (in bytes) of the requests of a pass on the host when mapping, of the MRAM images built at once
+ * on the host when indexing (0 if not limited).
+ */
+unsigned long long get_memory_budget();
+
+/**
+ * @brief Get the number of virtual DPUs of the index to pack in the MRAM of each DPU when mapping (at least 1).
+ */
+unsigned int get_nb_virtual_dpu_per_dpu();
+
 /**
  * @brief Parse and validate the argument of the application.
  */
@@ -20,6 +20,7 @@
 #include <errno.h>
 #include <pthread.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -48,6 +49,9 @@ enum error_code {
     ERR_NO_GOAL_DEFINED = -8,
     ERR_CURRENT_FOLDER_PERMISSIONS = -8,
     ERR_FOPEN_FAILED = -9,
+    ERR_INPUT_CORRUPTED = -10,
+    ERR_SIZE_READ_NOT_SUPPORTED = -11,
+    ERR_TOO_MANY_OPEN_FILES = -12,
 };
 
 #define WARNING(fmt, ...)                                                                                                        \
@@ -71,22 +75,48 @@ enum error_code {
             ERROR_EXIT(ERR_FOPEN_FAILED, "Could not open file '%s' (%s)", name, strerror(errno));                                \
     } while (0)
 
+/**
+ * @brief Make sure that "expected_limit" files can be opened, raising the soft limit if needed.
+ *
+ * It is called from the pipeline threads while the mapping runs: it exits instead of waiting for the user.
+ */
 static inline void check_ulimit_n(unsigned int expected_limit)
 {
     struct rlimit nofile_limit;
     assert(getrlimit(RLIMIT_NOFILE, &nofile_limit) == 0);
-    if ((unsigned int)nofile_limit.rlim_cur < expected_limit) {
-        WARNING("Number of file descriptor that can be opened by this process looks too small (current: %u - expected: %u), use "
-                "'ulimit -n' to set to appropriate value",
-            (unsigned int)nofile_limit.rlim_cur, expected_limit);
-        printf("Press any key to continue\n");
-        getchar();
+    if (nofile_limit.rlim_cur != RLIM_INFINITY && nofile_limit.rlim_cur < expected_limit) {
+        if (nofile_limit.rlim_max != RLIM_INFINITY && nofile_limit.rlim_max < expected_limit) {
+            ERROR_EXIT(ERR_TOO_MANY_OPEN_FILES,
+                "Number of file descriptor that can be opened by this process is too small (hard limit: %u - expected: %u), "
+                "use 'ulimit -n' to set to appropriate value",
+                (unsigned int)nofile_limit.rlim_max, expected_limit);
+        }
+        nofile_limit.rlim_cur = expected_limit;
+        assert(setrlimit(RLIMIT_NOFILE, &nofile_limit) == 0);
     }
 }
 
 #define XSTR(s) STR(s)
 #define STR(s) #s
 
+/**
+ * @brief Call "fct(size_read, arg)" for each supported size of read.
+ *
+ * Each supported size has its own DPU program, and its own instance of the host kernels that depend on the size of the
+ * reads, so that the size stays a constant in them. The filters of vartree.c are only calibrated for these sizes.
+ */
+#define FOREACH_SIZE_READ(fct, arg) fct(120, arg) fct(150, arg)
+
+#define SIZE_READ_IS(size_read, value) || (size_read) == (value)
+static inline bool size_read_supported(unsigned int size_read) { return false FOREACH_SIZE_READ(SIZE_READ_IS, size_read); }
+
+/**
+ * @brief Switch case returning the instance "kernel_<size_read>" of a kernel, see FOREACH_SIZE_READ.
+ */
+#define SIZE_READ_KERNEL_CASE(size_read, kernel)                                                                                 \
+    case size_read:                                                                                                              \
+        return kernel##_##size_read;
+
 #define NB_RANKS_MAX (64)
 extern unsigned int nb_dpus_per_run;
 #endif /* __UPVC_H__ */
@@ -5,6 +5,7 @@
 #include "accumulateread.h"
 #include "common.h"
 #include "index.h"
+#include "mram_dpu.h"
 #include "upvc.h"
 
 #include <assert.h>
@@ -12,12 +13,15 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/queue.h>
 #include <unistd.h>
 
 #define MIN(a, b) ((a) > (b) ? (b) : (a))
+#define MAX(a, b) ((a) < (b) ? (b) : (a))
 
 static FILE **result_file;
+static pthread_mutex_t result_file_mutex = PTHREAD_MUTEX_INITIALIZER;
 static acc_results_t *results_buffers[NB_DISPATCH_AND_ACC_BUFFER];
 #define RESULTS_BUFFERS(pass_id) results_buffers[(pass_id) % NB_DISPATCH_AND_ACC_BUFFER]
 
@@ -158,8 +162,22 @@ static void merge_bucket_and_acc_list(
     }
 }
 
-acc_results_t accumulate_get_result(unsigned int pass_id)
+/**
+ * @brief Get the result file of a pass, creating it if needed.
+ *
+ * When the number of pass is not known in advance (reads from a pipe), the list of result files grows as needed.
+ */
+static FILE *get_result_file(unsigned int pass_id)
 {
+    pthread_mutex_lock(&result_file_mutex);
+    if (pass_id >= nb_pass) {
+        unsigned int new_nb_pass = MAX(pass_id + 1, nb_pass * 2);
+        check_ulimit_n(new_nb_pass + 16);
+        result_file = (FILE **)realloc(result_file, sizeof(FILE *) * new_nb_pass);
+        assert(result_file != NULL);
+        memset(&result_file[nb_pass], 0, sizeof(FILE *) * (new_nb_pass - nb_pass));
+        nb_pass = new_nb_pass;
+    }
     if (result_file[pass_id] == NULL) {
         static const dpu_result_out_t dummy_res = { .num = -1 };
         char result_filename[512];
@@ -170,14 +188,23 @@ acc_results_t accumulate_get_result(unsigned int pass_id)
         assert(unlink(result_filename) == 0);
         fwrite(&dummy_res, sizeof(dummy_res), 1, result_file[pass_id]);
     }
+    FILE *f = result_file[pass_id];
+    pthread_mutex_unlock(&result_file_mutex);
 
-    fseek(result_file[pass_id], 0, SEEK_END);
-    size_t size = ftell(result_file[pass_id]);
-    rewind(result_file[pass_id]);
+    return f;
+}
+
+acc_results_t accumulate_get_result(unsigned int pass_id)
+{
+    FILE *f = get_result_file(pass_id);
+
+    fseek(f, 0, SEEK_END);
+    size_t size = ftell(f);
+    rewind(f);
 
     dpu_result_out_t *results = (dpu_result_out_t *)malloc(size);
     assert(results != NULL);
-    size_t size_read = fread(results, size, 1, result_file[pass_id]);
+    size_t size_read = fread(results, size, 1, f);
     assert(size_read == 1);
 
     return (acc_results_t) { .nb_res = (size / sizeof(dpu_result_out_t)) - 1, .results = results };
@@ -185,7 +212,7 @@ acc_results_t accumulate_get_result(unsigned int pass_id)
 
 void accumulate_read(unsigned int pass_id, unsigned int dpu_offset)
 {
-    nb_dpus_used_current_run = MIN(index_get_nb_dpu() - dpu_offset, nb_dpus_per_run);
+    nb_dpus_used_current_run = MIN(mram_get_nb_dpu() - dpu_offset, nb_dpus_per_run);
     acc_res = RESULTS_BUFFERS(pass_id);
 
     // compute the total number of resultat for all DPUs
@@ -245,8 +272,9 @@ void accumulate_read(unsigned int pass_id, unsigned int dpu_offset)
     // update FILE *
     free(acc_res_from_file.results);
     merged_result_tab[nb_read].num = -1;
-    rewind(result_file[pass_id]);
-    size_t written_size = fwrite(merged_result_tab, size, 1, result_file[pass_id]);
+    FILE *f = get_result_file(pass_id);
+    rewind(f);
+    size_t written_size = fwrite(merged_result_tab, size, 1, f);
     assert(written_size == 1);
     free(merged_result_tab);
     free(bucket_elems);
@@ -295,6 +323,7 @@ void accumulate_init(unsigned int max_nb_pass)
         for (unsigned int each_dpu = 0; each_dpu < nb_dpus_per_run; each_dpu++) {
             results_buffers[each_pass][each_dpu].results = (dpu_result_out_t *)malloc(sizeof(dpu_result_out_t) * MAX_DPU_RESULTS);
             assert(results_buffers[each_pass][each_dpu].results != NULL);
+            results_buffers[each_pass][each_dpu].max_nb_res = MAX_DPU_RESULTS;
         }
     }
 
@@ -315,3 +344,15 @@ void accumulate_init(unsigned int max_nb_pass)
 }
 
 acc_results_t *accumulate_get_buffer(unsigned int dpu_id, unsigned int pass_id) { return &(RESULTS_BUFFERS(pass_id)[dpu_id]); }
+
+acc_results_t *accumulate_reserve_buffer(unsigned int dpu_id, unsigned int pass_id, unsigned int nb_launch)
+{
+    acc_results_t *acc_res = accumulate_get_buffer(dpu_id, pass_id);
+    nb_result_t max_nb_res = (nb_result_t)MAX_DPU_RESULTS * nb_launch;
+    if (acc_res->max_nb_res < max_nb_res) {
+        acc_res->results = (dpu_result_out_t *)realloc(acc_res->results, sizeof(dpu_result_out_t) * max_nb_res);
+        assert(acc_res->results != NULL);
+        acc_res->max_nb_res = max_nb_res;
+    }
+    return acc_res;
+}
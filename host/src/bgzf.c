@@ -0,0 +1,338 @@
+/**
+ * Copyright 2016-2019 - Dominique Lavenier & UPMEM
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "bgzf.h"
+#include "upvc.h"
+
+#define BGZF_THREAD (4)
+#define BGZF_BLOCKS_PER_BATCH (128)
+#define BGZF_MAX_BLOCK_SIZE (1 << 16)
+#define BGZF_HEADER_SIZE (12)
+#define BGZF_FOOTER_SIZE (8)
+#define GZIP_BUFFER_SIZE (1 << 20)
+
+#define MIN(a, b) ((a) > (b) ? (b) : (a))
+
+/**
+ * @brief Group of consecutive BGZF blocks inflated together by the thread pool.
+ *
+ * @var nb_blocks  Number of blocks in the batch (0 when the end of the file has been reached).
+ * @var data       Start of the deflate stream of each block.
+ * @var data_size  Size of the deflate stream of each block.
+ * @var crc        CRC32 of the uncompressed data of each block.
+ * @var out_offset Offset in "out" of the uncompressed data of each block.
+ * @var out_size   Total size of the uncompressed data of the batch.
+ * @var out        Uncompressed data of the batch.
+ * @var running    Whether the thread pool is inflating this batch.
+ */
+typedef struct {
+    unsigned int nb_blocks;
+    const uint8_t *data[BGZF_BLOCKS_PER_BATCH];
+    uint32_t data_size[BGZF_BLOCKS_PER_BATCH];
+    uint32_t crc[BGZF_BLOCKS_PER_BATCH];
+    size_t out_offset[BGZF_BLOCKS_PER_BATCH + 1];
+    size_t out_size;
+    uint8_t *out;
+    bool running;
+} bgzf_batch_t;
+
+typedef struct {
+    bgzf_file_t *bf;
+    unsigned int thread_id;
+} bgzf_thread_arg_t;
+
+struct bgzf_file {
+    gzFile gz;
+
+    const uint8_t *data;
+    size_t size;
+    size_t next_block;
+    bgzf_batch_t batches[2];
+    unsigned int curr_batch;
+    size_t out_cursor;
+
+    bgzf_batch_t *pending_batch;
+    bool stop_threads;
+    sem_t start_sem[BGZF_THREAD];
+    sem_t done_sem;
+    pthread_t thread_id[BGZF_THREAD];
+    bgzf_thread_arg_t thread_args[BGZF_THREAD];
+    z_stream strm[BGZF_THREAD];
+};
+
+static uint16_t get_le16(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * @brief Get the size of the BGZF block starting at "block".
+ *
+ * @return The total size of the block, 0 if it is not a BGZF block.
+ */
+static size_t get_block_size(const uint8_t *block, size_t remaining)
+{
+    if (remaining < BGZF_HEADER_SIZE || block[0] != 0x1f || block[1] != 0x8b || block[2] != 8 || (block[3] & 4) == 0) {
+        return 0;
+    }
+    unsigned int xlen = get_le16(&block[10]);
+    if (remaining < BGZF_HEADER_SIZE + xlen) {
+        return 0;
+    }
+    const uint8_t *extra = &block[BGZF_HEADER_SIZE];
+    for (unsigned int each_byte = 0; each_byte + 4 <= xlen;) {
+        unsigned int slen = get_le16(&extra[each_byte + 2]);
+        if (extra[each_byte] == 'B' && extra[each_byte + 1] == 'C' && slen == 2) {
+            size_t block_size = get_le16(&extra[each_byte + 4]) + 1;
+            if (block_size > remaining || block_size < BGZF_HEADER_SIZE + xlen + BGZF_FOOTER_SIZE) {
+                return 0;
+            }
+            return block_size;
+        }
+        each_byte += 4 + slen;
+    }
+    return 0;
+}
+
+static void inflate_block(z_stream *strm, bgzf_batch_t *batch, unsigned int each_block)
+{
+    uint8_t *out = &batch->out[batch->out_offset[each_block]];
+    uint32_t out_size = batch->out_offset[each_block + 1] - batch->out_offset[each_block];
+
+    assert(inflateReset(strm) == Z_OK);
+    strm->next_in = (Bytef *)batch->data[each_block];
+    strm->avail_in = batch->data_size[each_block];
+    strm->next_out = out;
+    strm->avail_out = out_size;
+    int ret = inflate(strm, Z_FINISH);
+    if (ret != Z_STREAM_END || strm->avail_out != 0 || crc32(crc32(0L, Z_NULL, 0), out, out_size) != batch->crc[each_block]) {
+        ERROR_EXIT(ERR_INPUT_CORRUPTED, "%s: corrupted BGZF block", __func__);
+    }
+}
+
+static void *bgzf_thread_fct(void *arg)
+{
+    bgzf_file_t *bf = ((bgzf_thread_arg_t *)arg)->bf;
+    const unsigned int thread_id = ((bgzf_thread_arg_t *)arg)->thread_id;
+
+    while (true) {
+        sem_wait(&bf->start_sem[thread_id]);
+        if (bf->stop_threads) {
+            break;
+        }
+        bgzf_batch_t *batch = bf->pending_batch;
+        for (unsigned int each_block = thread_id; each_block < batch->nb_blocks; each_block += BGZF_THREAD) {
+            inflate_block(&bf->strm[thread_id], batch, each_block);
+        }
+        sem_post(&bf->done_sem);
+    }
+    return NULL;
+}
+
+static void bgzf_wait_batch(bgzf_file_t *bf, bgzf_batch_t *batch)
+{
+    if (!batch->running) {
+        return;
+    }
+    for (unsigned int each_thread = 0; each_thread < BGZF_THREAD; each_thread++) {
+        sem_wait(&bf->done_sem);
+    }
+    batch->running = false;
+}
+
+/**
+ * @brief Gather the next blocks of the file in "batch" and start to inflate them in the background.
+ */
+static void bgzf_start_batch(bgzf_file_t *bf, bgzf_batch_t *batch)
+{
+    batch->nb_blocks = 0;
+    batch->out_size = 0;
+    while (batch->nb_blocks < BGZF_BLOCKS_PER_BATCH && bf->next_block < bf->size) {
+        const uint8_t *block = &bf->data[bf->next_block];
+        size_t block_size = get_block_size(block, bf->size - bf->next_block);
+        if (block_size == 0) {
+            ERROR_EXIT(ERR_INPUT_CORRUPTED, "%s: invalid BGZF block at offset %lu", __func__, bf->next_block);
+        }
+        unsigned int xlen = get_le16(&block[10]);
+        uint32_t usize = get_le32(&block[block_size - 4]);
+        assert(usize <= BGZF_MAX_BLOCK_SIZE);
+
+        bf->next_block += block_size;
+        if (usize == 0) {
+            continue;
+        }
+        batch->data[batch->nb_blocks] = &block[BGZF_HEADER_SIZE + xlen];
+        batch->data_size[batch->nb_blocks] = block_size - BGZF_HEADER_SIZE - xlen - BGZF_FOOTER_SIZE;
+        batch->crc[batch->nb_blocks] = get_le32(&block[block_size - 8]);
+        batch->out_offset[batch->nb_blocks] = batch->out_size;
+        batch->out_size += usize;
+        batch->nb_blocks++;
+        batch->out_offset[batch->nb_blocks] = batch->out_size;
+    }
+    if (batch->nb_blocks == 0) {
+        return;
+    }
+
+    /* Each thread has its own start semaphore: a thread could otherwise take the token of another one, inflating its blocks
+     * twice and leaving the blocks of the other thread untouched */
+    bf->pending_batch = batch;
+    batch->running = true;
+    for (unsigned int each_thread = 0; each_thread < BGZF_THREAD; each_thread++) {
+        sem_post(&bf->start_sem[each_thread]);
+    }
+}
+
+static void bgzf_restart(bgzf_file_t *bf)
+{
+    bf->next_block = 0;
+    bf->curr_batch = 0;
+    bf->out_cursor = 0;
+    bgzf_start_batch(bf, &bf->batches[0]);
+    bgzf_wait_batch(bf, &bf->batches[0]);
+    bgzf_start_batch(bf, &bf->batches[1]);
+}
+
+bgzf_file_t *bgzf_open(FILE *f)
+{
+    int fd = fileno(f);
+    uint8_t magic[BGZF_HEADER_SIZE + 6];
+    ssize_t magic_size = pread(fd, magic, sizeof(magic), 0);
+    if (magic_size < 2 || magic[0] != 0x1f || magic[1] != 0x8b) {
+        return NULL;
+    }
+
+    bgzf_file_t *bf = (bgzf_file_t *)calloc(1, sizeof(bgzf_file_t));
+    assert(bf != NULL);
+
+    /* A BGZF file starts with a gzip header holding the "BC" extra subfield */
+    bool is_bgzf = magic_size == (ssize_t)sizeof(magic) && magic[2] == 8 && (magic[3] & 4) != 0 && magic[12] == 'B'
+        && magic[13] == 'C' && get_le16(&magic[14]) == 2;
+    if (!is_bgzf) {
+        /* Not a BGZF file: inflate it as a single stream */
+        int dup_fd = dup(fd);
+        assert(dup_fd >= 0 && lseek(dup_fd, 0, SEEK_SET) == 0);
+        bf->gz = gzdopen(dup_fd, "rb");
+        assert(bf->gz != NULL);
+        gzbuffer(bf->gz, GZIP_BUFFER_SIZE);
+        return bf;
+    }
+
+    struct stat st;
+    assert(fstat(fd, &st) == 0);
+    bf->size = (size_t)st.st_size;
+    void *data = mmap(NULL, bf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    assert(data != MAP_FAILED);
+    madvise(data, bf->size, MADV_SEQUENTIAL);
+    bf->data = (const uint8_t *)data;
+
+    for (unsigned int each_batch = 0; each_batch < 2; each_batch++) {
+        bf->batches[each_batch].out = (uint8_t *)malloc(BGZF_BLOCKS_PER_BATCH * BGZF_MAX_BLOCK_SIZE);
+        assert(bf->batches[each_batch].out != NULL);
+    }
+
+    assert(sem_init(&bf->done_sem, 0, 0) == 0);
+    for (unsigned int each_thread = 0; each_thread < BGZF_THREAD; each_thread++) {
+        assert(sem_init(&bf->start_sem[each_thread], 0, 0) == 0);
+        assert(inflateInit2(&bf->strm[each_thread], -MAX_WBITS) == Z_OK);
+    }
+    for (unsigned int each_thread = 0; each_thread < BGZF_THREAD; each_thread++) {
+        bf->thread_args[each_thread].bf = bf;
+        bf->thread_args[each_thread].thread_id = each_thread;
+        assert(pthread_create(&bf->thread_id[each_thread], NULL, bgzf_thread_fct, &bf->thread_args[each_thread]) == 0);
+    }
+
+    bgzf_restart(bf);
+    return bf;
+}
+
+size_t bgzf_read(bgzf_file_t *bf, char *buffer, size_t size)
+{
+    size_t size_read = 0;
+
+    if (bf->gz != NULL) {
+        while (size_read < size) {
+            int ret = gzread(bf->gz, &buffer[size_read], (unsigned int)MIN(size - size_read, GZIP_BUFFER_SIZE));
+            if (ret < 0) {
+                ERROR_EXIT(ERR_INPUT_CORRUPTED, "%s: %s", __func__, gzerror(bf->gz, &ret));
+            } else if (ret == 0) {
+                break;
+            }
+            size_read += ret;
+        }
+        return size_read;
+    }
+
+    while (size_read < size) {
+        bgzf_batch_t *batch = &bf->batches[bf->curr_batch];
+        if (bf->out_cursor == batch->out_size) {
+            bgzf_batch_t *next_batch = &bf->batches[1 - bf->curr_batch];
+            if (next_batch->nb_blocks == 0) {
+                break;
+            }
+            bgzf_wait_batch(bf, next_batch);
+            bgzf_start_batch(bf, batch);
+            bf->curr_batch = 1 - bf->curr_batch;
+            bf->out_cursor = 0;
+            continue;
+        }
+        size_t size_to_copy = MIN(size - size_read, batch->out_size - bf->out_cursor);
+        memcpy(&buffer[size_read], &batch->out[bf->out_cursor], size_to_copy);
+        bf->out_cursor += size_to_copy;
+        size_read += size_to_copy;
+    }
+    return size_read;
+}
+
+void bgzf_rewind(bgzf_file_t *bf)
+{
+    if (bf->gz != NULL) {
+        assert(gzrewind(bf->gz) == 0);
+        return;
+    }
+    bgzf_wait_batch(bf, &bf->batches[0]);
+    bgzf_wait_batch(bf, &bf->batches[1]);
+    bgzf_restart(bf);
+}
+
+void bgzf_close(bgzf_file_t *bf)
+{
+    if (bf->gz != NULL) {
+        gzclose(bf->gz);
+        free(bf);
+        return;
+    }
+
+    bgzf_wait_batch(bf, &bf->batches[0]);
+    bgzf_wait_batch(bf, &bf->batches[1]);
+    bf->stop_threads = true;
+    for (unsigned int each_thread = 0; each_thread < BGZF_THREAD; each_thread++) {
+        sem_post(&bf->start_sem[each_thread]);
+    }
+    for (unsigned int each_thread = 0; each_thread < BGZF_THREAD; each_thread++) {
+        assert(pthread_join(bf->thread_id[each_thread], NULL) == 0);
+        inflateEnd(&bf->strm[each_thread]);
+        assert(sem_destroy(&bf->start_sem[each_thread]) == 0);
+    }
+    assert(sem_destroy(&bf->done_sem) == 0);
+
+    for (unsigned int each_batch = 0; each_batch < 2; each_batch++) {
+        free(bf->batches[each_batch].out);
+    }
+    munmap((void *)bf->data, bf->size);
+    free(bf);
+}
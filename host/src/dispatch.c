@@ -11,15 +11,24 @@
 #include "dispatch.h"
 #include "getread.h"
 #include "index.h"
+#include "mram_dpu.h"
+#include "parse_args.h"
 #include "upvc.h"
 
 #define DISPATCHING_THREAD (8)
 #define DISPATCHING_THREAD_SLAVE (DISPATCHING_THREAD - 1)
 
+#define MIN(a, b) ((a) > (b) ? (b) : (a))
+
+/* Passes are sized by steps of PASS_SIZE_STEP reads, and aim at PASS_SIZE_TARGET of the budgets.
+ * They are never smaller than PASS_SIZE_MIN reads, as each pass keeps its result file open until the end of the mapping. */
+#define PASS_SIZE_STEP (MAX_READS_BUFFER / 64)
+#define PASS_SIZE_MIN (MAX_READS_BUFFER / 8)
+#define PASS_SIZE_TARGET (0.9)
+
 static dispatch_request_t *requests_buffers[NB_DISPATCH_AND_ACC_BUFFER];
 #define REQUESTS_BUFFERS(pass_id) requests_buffers[(pass_id) % NB_DISPATCH_AND_ACC_BUFFER]
 
-static unsigned int dispatch_pass_id;
 static int8_t *read_buffer;
 static int nb_read;
 static dispatch_request_t *requests;
@@ -27,31 +36,171 @@ static pthread_barrier_t barrier;
 static pthread_t thread_id[DISPATCHING_THREAD_SLAVE];
 static bool stop_threads = false;
 
-static void write_mem_DPU(index_seed_t *seed, int8_t *read, int num_read)
+typedef void (*dispatch_read_fct_t)(int thread_id);
+static dispatch_read_fct_t do_dispatch_read;
+
+/* Virtual DPUs of the index packed in each DPU, and size of their slots in neighbours (see mram_get_nb_slot) */
+static unsigned int nb_slot;
+static uint32_t slot_nb_neighbours;
+
+/**
+ * @brief Seed of the reference matching a read, staged before being written in the requests of its DPU.
+ */
+typedef struct {
+    index_seed_t *seed;
+    int num_read;
+} staged_hit_t;
+
+/**
+ * @brief Requests staged by a dispatching thread.
+ *
+ * Each thread stages the hits of a contiguous range of reads, in the order of the reads. Once every thread is done, a
+ * prefix sum of "nb_requests" over the threads gives to each thread the place of its hits in the requests of each DPU, so
+ * that the requests of a DPU are sorted by read without any atomic operation.
+ *
+ * @var hits         Hits of the reads of the thread.
+ * @var nb_hits      Number of hits in "hits".
+ * @var max_hits     Size allocated for "hits".
+ * @var nb_requests    Number of hits for each DPU, then index of the first request of the thread for each DPU.
+ * @var nb_neighbours  Number of neighbours to compare for each DPU.
+ * @var max_requests   Largest number of requests of the DPUs merged by the thread.
+ * @var max_neighbours Largest number of neighbours to compare of the DPUs merged by the thread.
+ */
+typedef struct {
+    staged_hit_t *hits;
+    unsigned int nb_hits;
+    unsigned int max_hits;
+    nb_request_t *nb_requests;
+    uint32_t *nb_neighbours;
+    nb_request_t max_requests;
+    uint64_t max_neighbours;
+} dispatch_staging_t;
+
+static dispatch_staging_t staging[DISPATCHING_THREAD];
+
+/**
+ * @brief Cost of a dispatched pass, used to size the passes read after it (see dispatch_get_pass_size).
+ *
+ * @var nb_read         Number of reads of the pass.
+ * @var nb_requests     Number of requests of the pass.
+ * @var max_requests    Largest number of requests sent to a DPU.
+ * @var max_neighbours  Largest number of neighbours to compare on a DPU, which sets the time of the pass on the DPUs.
+ */
+typedef struct {
+    unsigned int nb_read;
+    uint64_t nb_requests;
+    nb_request_t max_requests;
+    uint64_t max_neighbours;
+} pass_cost_t;
+
+static pass_cost_t pass_costs[NB_READS_BUFFER];
+static unsigned int last_pass_size;
+
+static inline void stage_reads(int thread_id, const unsigned int size_read)
 {
-    while (seed != NULL) {
-        unsigned int num_dpu = seed->num_dpu;
-        unsigned int nb_reads = __sync_fetch_and_add(&requests[num_dpu].nb_reads, 1);
-        dpu_request_t *new_read = &requests[num_dpu].dpu_requests[nb_reads];
-        new_read->offset = seed->offset;
-        new_read->count = seed->nb_nbr;
-        new_read->num = num_read;
+    dispatch_staging_t *stage = &staging[thread_id];
+    int first_read = (int)((int64_t)nb_read * thread_id / DISPATCHING_THREAD);
+    int last_read = (int)((int64_t)nb_read * (thread_id + 1) / DISPATCHING_THREAD);
+
+    memset(stage->nb_requests, 0, sizeof(nb_request_t) * mram_get_nb_dpu());
+    memset(stage->nb_neighbours, 0, sizeof(uint32_t) * mram_get_nb_dpu());
+    stage->nb_hits = 0;
+    for (int batch_read = first_read; batch_read < last_read; batch_read += INDEX_BATCH_SIZE) {
+        index_seed_t *seeds[INDEX_BATCH_SIZE];
+        unsigned int nb_seeds[INDEX_BATCH_SIZE];
+        unsigned int nb_read_batch = MIN(INDEX_BATCH_SIZE, last_read - batch_read);
+        index_get_batch(&read_buffer[batch_read * size_read], size_read, nb_read_batch, seeds, nb_seeds);
+
+        for (unsigned int each_read = 0; each_read < nb_read_batch; each_read++) {
+            for (index_seed_t *seed = seeds[each_read]; seed != &seeds[each_read][nb_seeds[each_read]]; seed++) {
+                if (stage->nb_hits == stage->max_hits) {
+                    stage->max_hits = (stage->max_hits == 0) ? MAX_DPU_REQUEST : stage->max_hits * 2;
+                    stage->hits = (staged_hit_t *)realloc(stage->hits, sizeof(staged_hit_t) * stage->max_hits);
+                    assert(stage->hits != NULL);
+                }
+                stage->hits[stage->nb_hits++] = (staged_hit_t) { .seed = seed, .num_read = batch_read + each_read };
+                stage->nb_requests[seed->num_dpu / nb_slot]++;
+                stage->nb_neighbours[seed->num_dpu / nb_slot] += seed->nb_nbr;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Compute the number of requests of the DPUs handled by the thread, and the first request of each thread for them.
+ */
+static void merge_staging(int thread_id)
+{
+    unsigned int nb_dpu = mram_get_nb_dpu();
+    unsigned int first_dpu = (unsigned int)((uint64_t)nb_dpu * thread_id / DISPATCHING_THREAD);
+    unsigned int last_dpu = (unsigned int)((uint64_t)nb_dpu * (thread_id + 1) / DISPATCHING_THREAD);
+    dispatch_staging_t *stage = &staging[thread_id];
 
-        index_copy_neighbour((int8_t *)new_read->nbr, read);
-        if (nb_reads > MAX_DPU_REQUEST) {
-            ERROR_EXIT(ERR_DISPATCH_BUFFER_FULL, "%s:[P%u]: Buffer full (DPU#%u)", __func__, dispatch_pass_id, num_dpu);
+    stage->max_requests = 0;
+    stage->max_neighbours = 0;
+    for (unsigned int num_dpu = first_dpu; num_dpu < last_dpu; num_dpu++) {
+        nb_request_t nb_reads = 0;
+        uint64_t nb_neighbours = 0;
+        for (unsigned int each_thread = 0; each_thread < DISPATCHING_THREAD; each_thread++) {
+            nb_request_t nb_requests = staging[each_thread].nb_requests[num_dpu];
+            staging[each_thread].nb_requests[num_dpu] = nb_reads;
+            nb_reads += nb_requests;
+            nb_neighbours += staging[each_thread].nb_neighbours[num_dpu];
+        }
+        if (nb_reads > stage->max_requests) {
+            stage->max_requests = nb_reads;
+        }
+        if (nb_neighbours > stage->max_neighbours) {
+            stage->max_neighbours = nb_neighbours;
         }
+        if (nb_reads > requests[num_dpu].max_reads) {
+            /* More than one launch will be needed for this DPU */
+            size_t size = (size_t)DPU_REQUEST_SIZE(index_get_size_read()) * nb_reads;
+            requests[num_dpu].dpu_requests = (dpu_request_t *)realloc(requests[num_dpu].dpu_requests, size);
+            assert(requests[num_dpu].dpu_requests != NULL);
+            requests[num_dpu].max_reads = nb_reads;
+        }
+        requests[num_dpu].nb_reads = nb_reads;
+    }
+}
+
+static inline void write_mem_DPU(int thread_id, const unsigned int size_read)
+{
+    dispatch_staging_t *stage = &staging[thread_id];
+
+    for (unsigned int each_hit = 0; each_hit < stage->nb_hits; each_hit++) {
+        index_seed_t *seed = stage->hits[each_hit].seed;
+        int num_read = stage->hits[each_hit].num_read;
+        unsigned int num_dpu = seed->num_dpu / nb_slot;
+        dpu_request_t *new_read = dispatch_get_request(&requests[num_dpu], stage->nb_requests[num_dpu]++, size_read);
+        /* The neighbours of a virtual DPU are in its slot of the MRAM */
+        new_read->offset = seed->offset + (seed->num_dpu % nb_slot) * slot_nb_neighbours;
+        new_read->count = seed->nb_nbr;
+        new_read->num = num_read;
 
-        seed = seed->next;
+        index_copy_neighbour((int8_t *)new_read->nbr, &read_buffer[num_read * size_read], SIZE_NEIGHBOUR_IN_BYTES_OF(size_read));
     }
 }
 
-static void do_dispatch_read(int thread_id)
+static inline void do_dispatch_read_kernel(int thread_id, const unsigned int size_read)
+{
+    stage_reads(thread_id, size_read);
+    pthread_barrier_wait(&barrier);
+    merge_staging(thread_id);
+    pthread_barrier_wait(&barrier);
+    write_mem_DPU(thread_id, size_read);
+}
+
+#define DO_DISPATCH_READ(size_read, unused)                                                                                      \
+    static void do_dispatch_read_##size_read(int thread_id) { do_dispatch_read_kernel(thread_id, size_read); }
+FOREACH_SIZE_READ(DO_DISPATCH_READ, )
+
+static dispatch_read_fct_t select_do_dispatch_read(unsigned int size_read)
 {
-    for (int num_read = thread_id; num_read < nb_read; num_read += DISPATCHING_THREAD) {
-        int8_t *read = &read_buffer[num_read * SIZE_READ];
-        index_seed_t *seed = index_get(read);
-        write_mem_DPU(seed, read, num_read);
+    switch (size_read) {
+        FOREACH_SIZE_READ(SIZE_READ_KERNEL_CASE, do_dispatch_read)
+    default:
+        ERROR_EXIT(ERR_SIZE_READ_NOT_SUPPORTED, "%s: reads of %u symbols are not supported", __func__, size_read);
     }
 }
 
@@ -69,34 +218,97 @@ static void *dispatch_read_thread_fct(void *arg)
 
 void dispatch_read(unsigned int pass_id)
 {
-    int nb_dpu = index_get_nb_dpu();
     requests = REQUESTS_BUFFERS(pass_id);
     read_buffer = get_reads_buffer(pass_id);
     nb_read = get_reads_in_buffer(pass_id);
-    dispatch_pass_id = pass_id;
-
-    for (int numdpu = 0; numdpu < nb_dpu; numdpu++) {
-        requests[numdpu].nb_reads = 0;
-    }
 
     pthread_barrier_wait(&barrier);
     do_dispatch_read(DISPATCHING_THREAD_SLAVE);
+
+    /* Every thread is done with merge_staging once the master is back from do_dispatch_read */
+    pass_cost_t *cost = &pass_costs[pass_id % NB_READS_BUFFER];
+    memset(cost, 0, sizeof(pass_cost_t));
+    cost->nb_read = nb_read;
+    for (unsigned int each_thread = 0; each_thread < DISPATCHING_THREAD; each_thread++) {
+        cost->nb_requests += staging[each_thread].nb_hits;
+        if (staging[each_thread].max_requests > cost->max_requests) {
+            cost->max_requests = staging[each_thread].max_requests;
+        }
+        if (staging[each_thread].max_neighbours > cost->max_neighbours) {
+            cost->max_neighbours = staging[each_thread].max_neighbours;
+        }
+    }
     pthread_barrier_wait(&barrier);
 }
 
+unsigned int dispatch_get_pass_size(unsigned int pass_id)
+{
+    unsigned int pass_size = MAX_READS_BUFFER;
+
+    if (pass_id >= NB_READS_BUFFER) {
+        /* The pass dispatched NB_READS_BUFFER passes before is the last one known to be dispatched */
+        pass_cost_t *cost = &pass_costs[pass_id % NB_READS_BUFFER];
+        double scale = (double)MAX_READS_BUFFER / cost->nb_read;
+        unsigned long long work_budget = get_work_budget();
+        unsigned long long memory_budget = get_memory_budget();
+
+        if (cost->max_requests != 0) {
+            scale = MIN(scale, PASS_SIZE_TARGET * MAX_DPU_REQUEST / cost->max_requests);
+        }
+        if (work_budget != 0 && cost->max_neighbours != 0) {
+            scale = MIN(scale, PASS_SIZE_TARGET * work_budget / cost->max_neighbours);
+        }
+        if (memory_budget != 0 && cost->nb_requests != 0) {
+            size_t request_size = DPU_REQUEST_SIZE(index_get_size_read()) + sizeof(staged_hit_t);
+            scale = MIN(scale, PASS_SIZE_TARGET * memory_budget / (cost->nb_requests * request_size));
+        }
+        pass_size = (unsigned int)(cost->nb_read * scale) / PASS_SIZE_STEP * PASS_SIZE_STEP;
+        if (pass_size < PASS_SIZE_MIN) {
+            pass_size = PASS_SIZE_MIN;
+        } else if (pass_size > MAX_READS_BUFFER) {
+            pass_size = MAX_READS_BUFFER;
+        }
+    }
+
+    if (pass_id == 0 || pass_size != last_pass_size) {
+        if (pass_id < NB_READS_BUFFER) {
+            printf("\tpass %u: %u reads\n", pass_id, pass_size);
+        } else {
+            pass_cost_t *cost = &pass_costs[pass_id % NB_READS_BUFFER];
+            printf("\tpass %u: %u reads (pass %u: %u reads, most loaded DPU: %u requests, %llu neighbours)\n", pass_id, pass_size,
+                pass_id - NB_READS_BUFFER, cost->nb_read, cost->max_requests, (unsigned long long)cost->max_neighbours);
+        }
+        last_pass_size = pass_size;
+    }
+    return pass_size;
+}
+
 void dispatch_init()
 {
-    unsigned int nb_dpu = index_get_nb_dpu();
+    unsigned int nb_dpu = mram_get_nb_dpu();
+    do_dispatch_read = select_do_dispatch_read(index_get_size_read());
+    nb_slot = mram_get_nb_slot();
+    slot_nb_neighbours = mram_get_slot_size() / COORDS_AND_NBR_SIZE(index_get_size_read());
     for (unsigned int each_pass = 0; each_pass < NB_DISPATCH_AND_ACC_BUFFER; each_pass++) {
         requests_buffers[each_pass] = (dispatch_request_t *)calloc(nb_dpu, sizeof(dispatch_request_t));
         assert(requests_buffers[each_pass] != NULL);
 
         for (unsigned int each_dpu = 0; each_dpu < nb_dpu; each_dpu++) {
-            requests_buffers[each_pass][each_dpu].dpu_requests = malloc(sizeof(dpu_request_t) * MAX_DPU_REQUEST);
+            requests_buffers[each_pass][each_dpu].dpu_requests = malloc(DPU_REQUEST_SIZE(index_get_size_read()) * MAX_DPU_REQUEST);
             assert(requests_buffers[each_pass][each_dpu].dpu_requests != NULL);
+            requests_buffers[each_pass][each_dpu].max_reads = MAX_DPU_REQUEST;
         }
     }
 
+    for (unsigned int each_thread = 0; each_thread < DISPATCHING_THREAD; each_thread++) {
+        staging[each_thread].hits = NULL;
+        staging[each_thread].nb_hits = staging[each_thread].max_hits = 0;
+        staging[each_thread].nb_requests = (nb_request_t *)malloc(sizeof(nb_request_t) * nb_dpu);
+        assert(staging[each_thread].nb_requests != NULL);
+        staging[each_thread].nb_neighbours = (uint32_t *)malloc(sizeof(uint32_t) * nb_dpu);
+        assert(staging[each_thread].nb_neighbours != NULL);
+    }
+
     assert(pthread_barrier_init(&barrier, NULL, DISPATCHING_THREAD) == 0);
     for (unsigned int each_thread = 0; each_thread < DISPATCHING_THREAD_SLAVE; each_thread++) {
         assert(pthread_create(&thread_id[each_thread], NULL, dispatch_read_thread_fct, (void *)(uintptr_t)each_thread) == 0);
@@ -105,13 +317,18 @@ void dispatch_init()
 
 void dispatch_free()
 {
-    unsigned int nb_dpu = index_get_nb_dpu();
+    unsigned int nb_dpu = mram_get_nb_dpu();
     for (unsigned int each_pass = 0; each_pass < NB_DISPATCH_AND_ACC_BUFFER; each_pass++) {
         for (unsigned int each_dpu = 0; each_dpu < nb_dpu; each_dpu++) {
             free(requests_buffers[each_pass][each_dpu].dpu_requests);
         }
         free(requests_buffers[each_pass]);
     }
+    for (unsigned int each_thread = 0; each_thread < DISPATCHING_THREAD; each_thread++) {
+        free(staging[each_thread].hits);
+        free(staging[each_thread].nb_requests);
+        free(staging[each_thread].nb_neighbours);
+    }
 
     stop_threads = true;
     pthread_barrier_wait(&barrier);
@@ -22,7 +22,21 @@
 
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
 
-DPU_INCBIN(upvc_dpu_program, DPU_BINARY);
+/* One DPU program for each supported size of read, built with the matching SIZE_READ */
+#define UPVC_DPU_PROGRAM(size_read, unused) DPU_INCBIN(upvc_dpu_program_##size_read, DPU_BINARY_##size_read);
+FOREACH_SIZE_READ(UPVC_DPU_PROGRAM, )
+
+#define UPVC_DPU_PROGRAM_CASE(size_read, unused)                                                                                 \
+    case size_read:                                                                                                              \
+        return &upvc_dpu_program_##size_read;
+static struct dpu_incbin_t *select_upvc_dpu_program(unsigned int size_read)
+{
+    switch (size_read) {
+        FOREACH_SIZE_READ(UPVC_DPU_PROGRAM_CASE, )
+    default:
+        ERROR_EXIT(ERR_SIZE_READ_NOT_SUPPORTED, "%s: no DPU program for reads of %u symbols", __func__, size_read);
+    }
+}
 
 struct triplet {
     uint32_t rank;
@@ -31,6 +45,7 @@ struct triplet {
 };
 
 typedef struct {
+    unsigned int nb_ranks;
     unsigned int nb_dpus_per_rank[NB_RANKS_MAX];
     unsigned int rank_mram_offset[NB_RANKS_MAX];
     unsigned int nb_dpus;
@@ -44,38 +59,88 @@ typedef struct {
 static bool dpu_backend_initialized = false;
 static devices_t devices;
 
-static void dpu_try_write_dispatch_into_mram(unsigned int dpu_offset, unsigned int pass_id)
+static const uint8_t dummy_dpu_requests[MAX_DPU_REQUEST * DPU_REQUEST_SIZE(SIZE_READ_MAX)];
+
+/**
+ * @brief Timing of the passes in flight, to show how the transfers of each rank overlap with the runs of the others.
+ *
+ * @var push_start     When each rank started to transfer the requests of the pass.
+ * @var push_end       When each rank launched the pass.
+ * @var nb_ranks_done  Number of ranks whose results have been transferred.
+ * @var busy_max       Longest run of the pass on a rank.
+ * @var transfer_max   Longest time spent by a rank in the transfers of the pass.
+ * @var end_max        When the last rank finished to transfer its results.
+ */
+typedef struct {
+    double push_start[NB_RANKS_MAX];
+    double push_end[NB_RANKS_MAX];
+    unsigned int nb_ranks_done;
+    double busy_max;
+    double transfer_max;
+    double end_max;
+} pass_timing_t;
+
+static pass_timing_t pass_timings[NB_DISPATCH_AND_ACC_BUFFER];
+static pthread_mutex_t pass_timings_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define PASS_TIMING(pass_id) (&pass_timings[(pass_id) % NB_DISPATCH_AND_ACC_BUFFER])
+
+/* Semaphores of the hand-off to the accumulation, posted by each rank once its results are transferred */
+static sem_t *exec_to_acc_sems;
+
+typedef union {
+    struct {
+        uint32_t dpu_offset;
+        uint32_t pass_id;
+    };
+    uint64_t info;
+} pass_info_t;
+
+_Static_assert(sizeof(pass_info_t) == sizeof(uint64_t), "dpu_callback using this type will not be functional");
+
+/**
+ * @brief Write the requests of the pass in the MRAM of the DPUs of one rank.
+ *
+ * Called for each rank when it reaches this point of its queue, so that a rank does not wait for the others, and the size of
+ * the transfer only depends on the DPUs of the rank.
+ */
+static dpu_error_t dpu_try_write_dispatch_into_mram(struct dpu_set_t rank, uint32_t rank_id, void *arg)
 {
-    static const dpu_request_t dummy_dpu_requests[MAX_DPU_REQUEST];
     static dispatch_request_t dummy_dispatch = {
         .nb_reads = 0,
         .dpu_requests = (dpu_request_t *)dummy_dpu_requests,
     };
 
-    dispatch_request_t *io_header[devices.nb_dpus];
+    pass_info_t info = (pass_info_t)(uintptr_t)arg;
+    dispatch_request_t *io_header[devices.nb_dpus_per_rank[rank_id]];
 
     struct dpu_set_t dpu;
     unsigned int each_dpu;
-    unsigned int nb_dpu = index_get_nb_dpu();
+    unsigned int nb_dpu = mram_get_nb_dpu();
+    unsigned int dpu_offset = info.dpu_offset + devices.rank_mram_offset[rank_id];
+    unsigned int pass_id = info.pass_id;
     unsigned int max_dispatch_size = 0;
-    DPU_FOREACH (devices.all_ranks, dpu, each_dpu) {
+    PASS_TIMING(pass_id)->push_start[rank_id] = my_clock();
+    DPU_FOREACH (rank, dpu, each_dpu) {
         unsigned int this_dpu = each_dpu + dpu_offset;
         if (this_dpu < nb_dpu) {
             io_header[each_dpu] = dispatch_get(this_dpu, pass_id);
         } else {
             io_header[each_dpu] = &dummy_dispatch;
         }
-        max_dispatch_size = MAX(max_dispatch_size, io_header[each_dpu]->nb_reads * sizeof(dpu_request_t));
+        max_dispatch_size = MAX(max_dispatch_size, io_header[each_dpu]->nb_reads * DPU_REQUEST_SIZE(index_get_size_read()));
     }
-    DPU_FOREACH (devices.all_ranks, dpu, each_dpu) {
+    DPU_FOREACH (rank, dpu, each_dpu) {
         DPU_ASSERT(dpu_prepare_xfer(dpu, &io_header[each_dpu]->nb_reads));
     }
-    DPU_ASSERT(dpu_push_xfer(devices.all_ranks, DPU_XFER_TO_DPU, XSTR(DPU_NB_REQUEST_VAR), 0, sizeof(nb_request_t), DPU_XFER_ASYNC));
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_TO_DPU, XSTR(DPU_NB_REQUEST_VAR), 0, sizeof(nb_request_t), DPU_XFER_DEFAULT));
 
-    DPU_FOREACH (devices.all_ranks, dpu, each_dpu) {
+    DPU_FOREACH (rank, dpu, each_dpu) {
         DPU_ASSERT(dpu_prepare_xfer(dpu, io_header[each_dpu]->dpu_requests));
     }
-    DPU_ASSERT(dpu_push_xfer(devices.all_ranks, DPU_XFER_TO_DPU, XSTR(DPU_REQUEST_VAR), 0, max_dispatch_size, DPU_XFER_ASYNC));
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_TO_DPU, XSTR(DPU_REQUEST_VAR), 0, max_dispatch_size, DPU_XFER_DEFAULT));
+
+    PASS_TIMING(pass_id)->push_end[rank_id] = my_clock();
+    return DPU_OK;
 }
 
 static __attribute__((used)) dpu_error_t dpu_try_log(struct dpu_set_t rank, uint32_t rank_id, void *arg)
@@ -103,7 +168,7 @@ static __attribute__((used)) dpu_error_t dpu_try_log(struct dpu_set_t rank, uint
 
     pthread_mutex_lock(&devices.log_mutex);
     fprintf(devices.log_file, "rank %u offset %u\n", rank_id, dpu_offset);
-    unsigned int nb_dpu = index_get_nb_dpu();
+    unsigned int nb_dpu = mram_get_nb_dpu();
     DPU_FOREACH (rank, dpu, each_dpu) {
         unsigned int this_dpu = each_dpu + dpu_offset;
         if (this_dpu >= nb_dpu)
@@ -151,28 +216,61 @@ static __attribute__((used)) dpu_error_t dpu_try_log(struct dpu_set_t rank, uint
     return DPU_OK;
 }
 
-typedef union {
-    struct {
-        uint32_t dpu_offset;
-        uint32_t pass_id;
-    };
-    uint64_t info;
-} pass_info_t;
-
-_Static_assert(sizeof(pass_info_t) == sizeof(uint64_t), "dpu_callback using this type will not be functional");
+/**
+ * @brief Account the timing of a rank for the pass, and print the timing of the pass once every rank is done.
+ */
+static void dpu_pass_timing_rank_done(unsigned int pass_id, uint32_t rank_id, double results_start, double results_end)
+{
+    pass_timing_t *timing = PASS_TIMING(pass_id);
+    double busy_time = results_start - timing->push_end[rank_id];
+    double transfer_time = (timing->push_end[rank_id] - timing->push_start[rank_id]) + (results_end - results_start);
+
+    pthread_mutex_lock(&pass_timings_mutex);
+    timing->busy_max = MAX(timing->busy_max, busy_time);
+    timing->transfer_max = MAX(timing->transfer_max, transfer_time);
+    timing->end_max = MAX(timing->end_max, results_end);
+    if (++timing->nb_ranks_done == devices.nb_ranks) {
+        double start_min = timing->push_start[0];
+        for (unsigned int each_rank = 1; each_rank < devices.nb_ranks; each_rank++) {
+            start_min = start_min < timing->push_start[each_rank] ? start_min : timing->push_start[each_rank];
+        }
+        printf("\tpass %u: %lf s, DPUs busy up to %lf s, transfers up to %lf s on a rank\n", pass_id, timing->end_max - start_min,
+            timing->busy_max, timing->transfer_max);
+        timing->nb_ranks_done = 0;
+        timing->busy_max = 0.0;
+        timing->transfer_max = 0.0;
+        timing->end_max = 0.0;
+    }
+    pthread_mutex_unlock(&pass_timings_mutex);
+}
 
-static dpu_error_t dpu_get_results(struct dpu_set_t rank, uint32_t rank_id, __attribute__((unused)) void *arg)
+/**
+ * @brief Transfer the results of the pass from the DPUs of one rank into the accumulate buffer, then hand them off to the
+ * accumulation.
+ */
+static dpu_error_t dpu_get_results(struct dpu_set_t rank, uint32_t rank_id, void *arg)
 {
     static dpu_result_out_t dummy_results[MAX_DPU_RESULTS];
+    static nb_result_t dummy_nb_results;
+    double results_start = my_clock();
     pass_info_t info = (pass_info_t)(uintptr_t)arg;
     struct dpu_set_t dpu;
     unsigned int each_dpu;
-    unsigned int nb_dpu = index_get_nb_dpu();
+    unsigned int nb_dpu = mram_get_nb_dpu();
     unsigned int max_nb_result = 0;
     unsigned int mram_offset = devices.rank_mram_offset[rank_id];
     unsigned int dpu_offset = info.dpu_offset + mram_offset;
     unsigned int pass_id = info.pass_id;
 
+    DPU_FOREACH (rank, dpu, each_dpu) {
+        nb_result_t *nb_results = &dummy_nb_results;
+        if ((each_dpu + dpu_offset) < nb_dpu) {
+            nb_results = &accumulate_get_buffer(each_dpu + mram_offset, pass_id)->nb_res;
+        }
+        DPU_ASSERT(dpu_prepare_xfer(dpu, nb_results));
+    }
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, XSTR(DPU_NB_RESULT_VAR), 0, sizeof(nb_result_t), DPU_XFER_DEFAULT));
+
     DPU_FOREACH (rank, dpu, each_dpu) {
         uint8_t *results;
         if ((each_dpu + dpu_offset) < nb_dpu) {
@@ -187,75 +285,165 @@ static dpu_error_t dpu_get_results(struct dpu_set_t rank, uint32_t rank_id, __at
     DPU_ASSERT(dpu_push_xfer(
         rank, DPU_XFER_FROM_DPU, XSTR(DPU_RESULT_VAR), 0, (max_nb_result + 1) * sizeof(dpu_result_out_t), DPU_XFER_DEFAULT));
 
+    dpu_pass_timing_rank_done(pass_id, rank_id, results_start, my_clock());
+    sem_post(&exec_to_acc_sems[rank_id]);
     return DPU_OK;
 }
 
-static void dpu_try_get_results_and_log(unsigned int dpu_offset, unsigned int pass_id)
+/* The stage semaphores have one entry for each rank: every rank hands off its passes on its own */
+static dpu_error_t sem_post_dispatch_free_sem(__attribute__((unused)) struct dpu_set_t set, uint32_t rank_id, void *arg)
 {
-    static nb_result_t dummy_nb_results;
+    sem_post(&((sem_t *)arg)[rank_id]);
+    return DPU_OK;
+}
+
+static void sem_post_each_rank(sem_t *sems)
+{
+    for (unsigned int each_rank = 0; each_rank < devices.nb_ranks; each_rank++) {
+        sem_post(&sems[each_rank]);
+    }
+}
+
+/**
+ * @brief Number of launches needed by the DPUs of the run to handle their requests of the pass.
+ */
+static unsigned int dpu_get_nb_launch(unsigned int dpu_offset, unsigned int pass_id)
+{
+    unsigned int nb_launch = 1;
+    unsigned int nb_dpu = mram_get_nb_dpu();
+    for (unsigned int each_dpu = 0; each_dpu < devices.nb_dpus && each_dpu + dpu_offset < nb_dpu; each_dpu++) {
+        nb_launch = MAX(nb_launch, dispatch_nb_launch(dispatch_get(each_dpu + dpu_offset, pass_id)->nb_reads));
+    }
+    return nb_launch;
+}
 
+/**
+ * @brief Run a pass in which some DPUs received more than MAX_DPU_REQUEST requests.
+ *
+ * The requests are sent in several launches of at most MAX_DPU_REQUEST requests per DPU, and the results of each launch are
+ * appended to the results of the previous ones. This should not happen often, so the launches are synchronous.
+ */
+static void run_on_dpu_split(
+    unsigned int dpu_offset, unsigned int pass_id, unsigned int nb_launch, sem_t *dispatch_free_sem, sem_t *acc_wait_sem)
+{
+    static dpu_result_out_t dummy_results[MAX_DPU_RESULTS];
+    const unsigned int size_read = index_get_size_read();
+    unsigned int nb_dpu = mram_get_nb_dpu();
+    dispatch_request_t *io_header[devices.nb_dpus];
+    acc_results_t *acc_res[devices.nb_dpus];
+    nb_request_t nb_reads[devices.nb_dpus];
+    nb_result_t nb_res[devices.nb_dpus];
     struct dpu_set_t dpu;
     unsigned int each_dpu;
-    unsigned int nb_dpu = index_get_nb_dpu();
-    DPU_FOREACH (devices.all_ranks, dpu, each_dpu) {
-        uint8_t *results;
-        if ((each_dpu + dpu_offset) < nb_dpu) {
-            results = (uint8_t *)&(accumulate_get_buffer(each_dpu, pass_id)->nb_res);
+
+    DPU_ASSERT(dpu_sync(devices.all_ranks));
+    sem_wait(acc_wait_sem);
+
+    for (each_dpu = 0; each_dpu < devices.nb_dpus; each_dpu++) {
+        unsigned int this_dpu = each_dpu + dpu_offset;
+        if (this_dpu < nb_dpu) {
+            io_header[each_dpu] = dispatch_get(this_dpu, pass_id);
+            acc_res[each_dpu] = accumulate_reserve_buffer(each_dpu, pass_id, dispatch_nb_launch(io_header[each_dpu]->nb_reads));
+            acc_res[each_dpu]->nb_res = 0;
+            acc_res[each_dpu]->results[0].num = -1;
         } else {
-            results = (uint8_t *)&dummy_nb_results;
+            io_header[each_dpu] = NULL;
+            acc_res[each_dpu] = NULL;
         }
-        DPU_ASSERT(dpu_prepare_xfer(dpu, results));
     }
-    DPU_ASSERT(dpu_push_xfer(devices.all_ranks, DPU_XFER_FROM_DPU, XSTR(DPU_NB_RESULT_VAR), 0, sizeof(nb_result_t), DPU_XFER_ASYNC));
 
-    pass_info_t info = { .dpu_offset = dpu_offset, .pass_id = pass_id };
-    DPU_ASSERT(dpu_callback(devices.all_ranks, dpu_get_results, (void *)info.info, DPU_CALLBACK_ASYNC));
-#ifdef STATS_ON
-    DPU_ASSERT(dpu_callback(devices.all_ranks, dpu_try_log, (void *)dpu_offset, DPU_CALLBACK_ASYNC));
-#endif
-}
+    for (unsigned int each_launch = 0; each_launch < nb_launch; each_launch++) {
+        unsigned int max_dispatch_size = 0;
+        DPU_FOREACH (devices.all_ranks, dpu, each_dpu) {
+            nb_reads[each_dpu] = (io_header[each_dpu] != NULL) ? dispatch_nb_reads_in_launch(io_header[each_dpu], each_launch) : 0;
+            max_dispatch_size = MAX(max_dispatch_size, nb_reads[each_dpu] * DPU_REQUEST_SIZE(size_read));
+            DPU_ASSERT(dpu_prepare_xfer(dpu, &nb_reads[each_dpu]));
+        }
+        DPU_ASSERT(
+            dpu_push_xfer(devices.all_ranks, DPU_XFER_TO_DPU, XSTR(DPU_NB_REQUEST_VAR), 0, sizeof(nb_request_t), DPU_XFER_DEFAULT));
+
+        DPU_FOREACH (devices.all_ranks, dpu, each_dpu) {
+            const void *requests = (nb_reads[each_dpu] != 0)
+                ? dispatch_get_request(io_header[each_dpu], each_launch * MAX_DPU_REQUEST, size_read)
+                : (const void *)dummy_dpu_requests;
+            DPU_ASSERT(dpu_prepare_xfer(dpu, (void *)requests));
+        }
+        DPU_ASSERT(dpu_push_xfer(devices.all_ranks, DPU_XFER_TO_DPU, XSTR(DPU_REQUEST_VAR), 0, max_dispatch_size, DPU_XFER_DEFAULT));
 
-static dpu_error_t sem_post_dispatch_free_sem(
-    __attribute__((unused)) struct dpu_set_t set, __attribute__((unused)) uint32_t rank_id, void *arg)
-{
-    sem_post((sem_t *)arg);
-    return DPU_OK;
-}
+        if (each_launch == nb_launch - 1) {
+            sem_post_each_rank(dispatch_free_sem);
+        }
+        DPU_ASSERT(dpu_launch(devices.all_ranks, DPU_SYNCHRONOUS));
 
-static dpu_error_t sem_post_exec_to_acc_sem(
-    __attribute__((unused)) struct dpu_set_t set, __attribute__((unused)) uint32_t rank_id, void *arg)
-{
-    sem_post((sem_t *)arg);
-    return DPU_OK;
+        DPU_FOREACH (devices.all_ranks, dpu, each_dpu) {
+            DPU_ASSERT(dpu_prepare_xfer(dpu, &nb_res[each_dpu]));
+        }
+        DPU_ASSERT(
+            dpu_push_xfer(devices.all_ranks, DPU_XFER_FROM_DPU, XSTR(DPU_NB_RESULT_VAR), 0, sizeof(nb_result_t), DPU_XFER_DEFAULT));
+
+        unsigned int max_nb_result = 0;
+        DPU_FOREACH (devices.all_ranks, dpu, each_dpu) {
+            dpu_result_out_t *results = dummy_results;
+            if (nb_reads[each_dpu] != 0) {
+                results = &acc_res[each_dpu]->results[acc_res[each_dpu]->nb_res];
+                max_nb_result = MAX(max_nb_result, nb_res[each_dpu]);
+            }
+            DPU_ASSERT(dpu_prepare_xfer(dpu, results));
+        }
+        DPU_ASSERT(dpu_push_xfer(devices.all_ranks, DPU_XFER_FROM_DPU, XSTR(DPU_RESULT_VAR), 0,
+            (max_nb_result + 1) * sizeof(dpu_result_out_t), DPU_XFER_DEFAULT));
+        for (each_dpu = 0; each_dpu < devices.nb_dpus; each_dpu++) {
+            if (nb_reads[each_dpu] != 0) {
+                acc_res[each_dpu]->nb_res += nb_res[each_dpu];
+            }
+        }
+#ifdef STATS_ON
+        DPU_ASSERT(dpu_callback(devices.all_ranks, dpu_try_log, (void *)(uintptr_t)dpu_offset, DPU_CALLBACK_DEFAULT));
+#endif
+    }
 }
 
 void run_on_dpu(unsigned int dpu_offset, unsigned int pass_id, sem_t *dispatch_free_sem, sem_t *acc_wait_sem,
     sem_t *exec_to_acc_sem, sem_t *dispatch_to_exec_sem)
 {
-    dpu_try_write_dispatch_into_mram(dpu_offset, pass_id);
+    unsigned int nb_launch = dpu_get_nb_launch(dpu_offset, pass_id);
+    if (nb_launch > 1) {
+        run_on_dpu_split(dpu_offset, pass_id, nb_launch, dispatch_free_sem, acc_wait_sem);
+        sem_post_each_rank(exec_to_acc_sem);
+        sem_wait(dispatch_to_exec_sem);
+        return;
+    }
 
-    DPU_ASSERT(dpu_callback(devices.all_ranks, sem_post_dispatch_free_sem, dispatch_free_sem,
-        DPU_CALLBACK_ASYNC | DPU_CALLBACK_NONBLOCKING | DPU_CALLBACK_SINGLE_CALL));
+    /* Each rank pushes its requests, launches, then transfers and hands off its results as soon as its own queue gets there,
+     * while the other ranks are running */
+    pass_info_t info = { .dpu_offset = dpu_offset, .pass_id = pass_id };
+    DPU_ASSERT(dpu_callback(devices.all_ranks, dpu_try_write_dispatch_into_mram, (void *)info.info, DPU_CALLBACK_ASYNC));
+    DPU_ASSERT(dpu_callback(
+        devices.all_ranks, sem_post_dispatch_free_sem, dispatch_free_sem, DPU_CALLBACK_ASYNC | DPU_CALLBACK_NONBLOCKING));
     DPU_ASSERT(dpu_launch(devices.all_ranks, DPU_ASYNCHRONOUS));
+#ifdef STATS_ON
+    DPU_ASSERT(dpu_callback(devices.all_ranks, dpu_try_log, (void *)(uintptr_t)dpu_offset, DPU_CALLBACK_ASYNC));
+#endif
     sem_wait(acc_wait_sem);
 
-    dpu_try_get_results_and_log(dpu_offset, pass_id);
-
-    DPU_ASSERT(dpu_callback(devices.all_ranks, sem_post_exec_to_acc_sem, exec_to_acc_sem,
-        DPU_CALLBACK_ASYNC | DPU_CALLBACK_NONBLOCKING | DPU_CALLBACK_SINGLE_CALL));
+    exec_to_acc_sems = exec_to_acc_sem;
+    DPU_ASSERT(dpu_callback(devices.all_ranks, dpu_get_results, (void *)info.info, DPU_CALLBACK_ASYNC));
     sem_wait(dispatch_to_exec_sem);
 }
 
-void init_backend_dpu(unsigned int *nb_dpus_per_run)
+void init_backend_dpu(unsigned int *nb_dpus_per_run, unsigned int *nb_ranks_per_run)
 {
     const char *profile = "cycleAccurate=true,nrJobsPerRank=64";
 
     DPU_ASSERT(dpu_alloc(get_nb_dpu(), profile, &devices.all_ranks));
-    DPU_ASSERT(dpu_load_from_incbin(devices.all_ranks, &upvc_dpu_program, NULL));
+    DPU_ASSERT(dpu_load_from_incbin(devices.all_ranks, select_upvc_dpu_program(index_get_size_read()), NULL));
     DPU_ASSERT(dpu_get_nr_dpus(devices.all_ranks, nb_dpus_per_run));
 
     unsigned int each_rank;
     struct dpu_set_t rank;
+    DPU_ASSERT(dpu_get_nr_ranks(devices.all_ranks, &devices.nb_ranks));
+    assert(devices.nb_ranks <= NB_RANKS_MAX);
+    *nb_ranks_per_run = devices.nb_ranks;
     devices.nb_dpus = 0;
     DPU_RANK_FOREACH (devices.all_ranks, rank, each_rank) {
         devices.ranks[each_rank] = rank;
@@ -298,52 +486,65 @@ void free_backend_dpu()
 typedef union {
     struct {
         uint32_t dpu_offset;
-        uint32_t delta_neighbour;
+        uint32_t bank;
     };
     uint64_t info;
 } load_info_t;
 
+_Static_assert(sizeof(load_info_t) == sizeof(uint64_t), "dpu_callback using this type will not be functional");
+
 static dpu_error_t load_mram_rank(struct dpu_set_t rank, uint32_t rank_id, void *args) {
     load_info_t info = (load_info_t)(uintptr_t)args;
     unsigned int dpu_offset = info.dpu_offset;
-    unsigned int delta_neighbour = info.delta_neighbour;
-    unsigned int nb_dpu = index_get_nb_dpu();
-    unsigned int nb_dpus_per_rank = devices.nb_dpus_per_rank[rank_id];
-    uint8_t *mram[nb_dpus_per_rank];
-    size_t mram_size[nb_dpus_per_rank];
-
-    memset(mram, 0, sizeof(uint8_t *) * nb_dpus_per_rank);
-    memset(mram_size, 0, sizeof(size_t) * nb_dpus_per_rank);
+    unsigned int bank_offset = info.bank * mram_get_bank_size();
+    unsigned int nb_dpu = mram_get_nb_dpu();
 
     unsigned int each_dpu;
     struct dpu_set_t dpu;
     dpu_offset += devices.rank_mram_offset[rank_id];
-    DPU_FOREACH (rank, dpu, each_dpu) {
-        unsigned int this_dpu = dpu_offset + each_dpu;
-        if (this_dpu < nb_dpu) {
-            mram_size[each_dpu] = mram_load(&mram[each_dpu], this_dpu);
+    /* One transfer for each slot of the MRAM, the images of the virtual DPUs being transferred from the mapped file */
+    for (unsigned int each_slot = 0; each_slot < mram_get_nb_slot(); each_slot++) {
+        size_t max_mram_size = 0;
+        DPU_FOREACH (rank, dpu, each_dpu) {
+            uint8_t *mram = NULL;
+            unsigned int this_dpu = dpu_offset + each_dpu;
+            if (this_dpu < nb_dpu) {
+                max_mram_size = MAX(max_mram_size, mram_load(&mram, this_dpu, each_slot));
+            }
+            DPU_ASSERT(dpu_prepare_xfer(dpu, mram));
+        }
+        if (max_mram_size != 0) {
+            DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME,
+                bank_offset + each_slot * mram_get_slot_size(), max_mram_size, DPU_XFER_DEFAULT));
         }
     }
+    return DPU_OK;
+}
 
-    unsigned int max_mram_size = 0;
-    DPU_FOREACH (rank, dpu, each_dpu) {
-        DPU_ASSERT(dpu_prepare_xfer(dpu, mram[each_dpu]));
-        max_mram_size = MAX(max_mram_size, mram_size[each_dpu]);
-    }
-    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 0, max_mram_size, DPU_XFER_DEFAULT));
+void load_mram_dpu(unsigned int dpu_offset, unsigned int bank)
+{
+    load_info_t info = { .dpu_offset = dpu_offset, .bank = bank };
+    dpu_callback(devices.all_ranks, load_mram_rank, (void *)info.info, DPU_CALLBACK_ASYNC);
+}
 
-    DPU_ASSERT(dpu_copy_to(rank, XSTR(DPU_MRAM_INFO_VAR), 0, &delta_neighbour, sizeof(delta_neighbour)));
+typedef union {
+    mram_info_t mram_info;
+    uint64_t info;
+} select_info_t;
 
-    DPU_FOREACH (rank, dpu, each_dpu) {
-        free(mram[each_dpu]);
-    }
+_Static_assert(sizeof(select_info_t) == sizeof(uint64_t), "dpu_callback using this type will not be functional");
+
+static dpu_error_t select_mram_rank(struct dpu_set_t rank, __attribute__((unused)) uint32_t rank_id, void *args)
+{
+    select_info_t info = { .info = (uint64_t)(uintptr_t)args };
+    DPU_ASSERT(dpu_copy_to(rank, XSTR(DPU_MRAM_INFO_VAR), 0, &info.mram_info, sizeof(mram_info_t)));
     return DPU_OK;
 }
 
-void load_mram_dpu(unsigned int dpu_offset, int delta_neighbour)
+void select_mram_dpu(unsigned int bank, int delta_neighbour)
 {
-    load_info_t info = {.dpu_offset = dpu_offset, delta_neighbour = delta_neighbour};
-    dpu_callback(devices.all_ranks, load_mram_rank, (void *)info.info, DPU_CALLBACK_ASYNC);
+    select_info_t info = { .mram_info = { .delta = delta_neighbour, .bank_offset = bank * mram_get_bank_size() } };
+    dpu_callback(devices.all_ranks, select_mram_rank, (void *)info.info, DPU_CALLBACK_ASYNC);
 }
 
 void wait_dpu_dpu() {
@@ -5,22 +5,92 @@
 #include "index.h"
 #define _POSIX_C_SOURCE 200809L
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "genome.h"
+#include "nucleotide.h"
 #include "parse_args.h"
 #include "upvc.h"
 
-#define MAX_BUF_SIZE (1024)
 #define GENOME_BINARY "genome.bin"
-#define GENOME_VERSION (1)
+#define GENOME_VERSION (3)
 #define GENOME_MAGIC (0x9e503e)
 
 static genome_t genome = { .magic = GENOME_MAGIC, .version = GENOME_VERSION };
 
+/* Mapping of the genome file when the genome has been loaded */
+static uint8_t *genome_mapping;
+static size_t genome_mapping_size;
+
 genome_t *genome_get() { return &genome; }
 
+bool genome_is_n(genome_t *genome, uint64_t pos)
+{
+    /* Find the last run starting at or before "pos" */
+    uint64_t first = 0, last = genome->nb_n_runs;
+    while (first < last) {
+        uint64_t middle = first + (last - first) / 2;
+        if (genome->n_runs[middle].start <= pos) {
+            first = middle + 1;
+        } else {
+            last = middle;
+        }
+    }
+    return first != 0 && pos < genome->n_runs[first - 1].start + genome->n_runs[first - 1].len;
+}
+
+void genome_get_bases(genome_t *genome, uint64_t pos, unsigned int len, int8_t *bases)
+{
+    uint64_t end = pos + len;
+    for (unsigned int i = 0; i < len; i++) {
+        uint64_t each_pos = pos + i;
+        if (each_pos >= genome->nb_bases) {
+            bases[i] = GENOME_CODE_N;
+        } else {
+            bases[i] = (genome->packed[each_pos / GENOME_BASES_PER_WORD] >> ((each_pos % GENOME_BASES_PER_WORD) * 2)) & 3;
+        }
+    }
+    if (pos >= genome->nb_bases || end < pos) {
+        return;
+    }
+    if (end > genome->nb_bases) {
+        end = genome->nb_bases;
+    }
+
+    bool has_n = false;
+    for (uint64_t n_block = pos / GENOME_N_BLOCK_SIZE; n_block <= (end - 1) / GENOME_N_BLOCK_SIZE; n_block++) {
+        has_n |= (genome->n_blocks[n_block / 64] >> (n_block % 64)) & 1;
+    }
+    if (!has_n) {
+        return;
+    }
+
+    /* Find the first run ending after "pos" */
+    uint64_t first = 0, last = genome->nb_n_runs;
+    while (first < last) {
+        uint64_t middle = first + (last - first) / 2;
+        if (genome->n_runs[middle].start + genome->n_runs[middle].len <= pos) {
+            first = middle + 1;
+        } else {
+            last = middle;
+        }
+    }
+    for (; first < genome->nb_n_runs && genome->n_runs[first].start < end; first++) {
+        uint64_t run_start = genome->n_runs[first].start < pos ? pos : genome->n_runs[first].start;
+        uint64_t run_end = genome->n_runs[first].start + genome->n_runs[first].len;
+        if (run_end > end) {
+            run_end = end;
+        }
+        memset(&bases[run_start - pos], GENOME_CODE_N, run_end - run_start);
+    }
+}
+
+static uint64_t genome_nb_packed_words(uint64_t nb_bases) { return nb_bases / GENOME_BASES_PER_WORD + 1; }
+static uint64_t genome_nb_n_blocks_words(uint64_t nb_bases) { return nb_bases / (GENOME_N_BLOCK_SIZE * 64) + 1; }
+
 void genome_load()
 {
     double start_time = my_clock();
@@ -33,28 +103,204 @@ void genome_load()
     FILE *f = fopen(filename, "r");
     CHECK_FILE(f, filename);
 
-    xfer_file((uint8_t *)&genome, sizeof(genome_t), f, xfer_read);
+    genome_mapping = map_file(f, &genome_mapping_size);
+    fclose(f);
+    assert(genome_mapping_size >= sizeof(genome_t));
+    memcpy(&genome, genome_mapping, sizeof(genome_t));
 
     assert(genome.magic == GENOME_MAGIC
         && "Wrong header, make sure you have generated your MRAMs with the same version of UPVC that you are using.");
     assert(genome.version == GENOME_VERSION && "Could not load a genome generated with a different version of UPVC.");
+    assert(genome.n_runs_offset + genome.nb_n_runs * sizeof(genome_n_run_t) <= genome_mapping_size);
 
-    genome.data = (int8_t *)malloc(sizeof(int8_t) * genome.fasta_file_size);
-    genome.mapping_coverage = (int32_t *)calloc(sizeof(int32_t), genome.fasta_file_size);
-    assert(genome.data != NULL && genome.mapping_coverage != NULL);
-
-    xfer_file((uint8_t *)genome.data, genome.fasta_file_size, f, xfer_read);
-
-    fclose(f);
+    genome.packed = (uint64_t *)&genome_mapping[genome.packed_offset];
+    genome.n_blocks = (uint64_t *)&genome_mapping[genome.n_blocks_offset];
+    genome.n_runs = (genome_n_run_t *)&genome_mapping[genome.n_runs_offset];
+    genome.mapping_coverage = (int32_t *)calloc(sizeof(int32_t), genome.nb_bases);
+    assert(genome.mapping_coverage != NULL);
 
     printf("\t#seq: %d\n", genome.nb_seq);
     printf("\ttime: %lf s\n", my_clock() - start_time);
 }
 
+#define GENOME_THREAD (16)
+#define GENOME_THREAD_SLAVE (GENOME_THREAD - 1)
+/* Number of bytes of the fasta file encoded by a thread at once */
+#define FASTA_CHUNK_SIZE (1 << 22)
+#define FASTA_ENCODE_SIZE (4096)
+
+/**
+ * @brief Part of the body of a sequence of the fasta file, encoded by one thread.
+ *
+ * @var start     Offset in the fasta file of the first byte of the chunk.
+ * @var end       Offset in the fasta file after the last byte of the chunk.
+ * @var seq       Sequence of the chunk.
+ * @var pos       Position in the genome of the first base of the chunk.
+ * @var nb_bases  Number of bases in the chunk.
+ * @var n_runs    Runs of 'N' of the chunk.
+ */
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    uint32_t seq;
+    uint64_t pos;
+    uint64_t nb_bases;
+    genome_n_run_t *n_runs;
+    uint64_t nb_n_runs;
+    uint64_t max_n_runs;
+} fasta_chunk_t;
+
+static const char *fasta;
+static fasta_chunk_t *fasta_chunks;
+static unsigned int nb_fasta_chunks;
+static pthread_barrier_t barrier;
+
+static bool is_end_of_line(char c) { return c == '\n' || c == '\r'; }
+
+static void fasta_chunk_count(fasta_chunk_t *chunk)
+{
+    uint64_t nb_end_of_line = 0;
+    for (uint64_t i = chunk->start; i < chunk->end; i++) {
+        nb_end_of_line += is_end_of_line(fasta[i]);
+    }
+    chunk->nb_bases = chunk->end - chunk->start - nb_end_of_line;
+}
+
+static void fasta_chunk_add_n(fasta_chunk_t *chunk, uint64_t pos)
+{
+    uint64_t n_block = pos / GENOME_N_BLOCK_SIZE;
+    uint64_t n_block_mask = 1ULL << (n_block % 64);
+    if ((genome.n_blocks[n_block / 64] & n_block_mask) == 0) {
+        __sync_fetch_and_or(&genome.n_blocks[n_block / 64], n_block_mask);
+    }
+    if (chunk->nb_n_runs != 0 && chunk->n_runs[chunk->nb_n_runs - 1].start + chunk->n_runs[chunk->nb_n_runs - 1].len == pos) {
+        chunk->n_runs[chunk->nb_n_runs - 1].len++;
+        return;
+    }
+    if (chunk->nb_n_runs == chunk->max_n_runs) {
+        chunk->max_n_runs = chunk->max_n_runs == 0 ? 64 : chunk->max_n_runs * 2;
+        chunk->n_runs = (genome_n_run_t *)realloc(chunk->n_runs, chunk->max_n_runs * sizeof(genome_n_run_t));
+        assert(chunk->n_runs != NULL);
+    }
+    chunk->n_runs[chunk->nb_n_runs++] = (genome_n_run_t) { .start = pos, .len = 1 };
+}
+
+static void fasta_chunk_encode(fasta_chunk_t *chunk)
+{
+    int8_t bases[FASTA_ENCODE_SIZE];
+    const uint64_t first_word = chunk->pos / GENOME_BASES_PER_WORD;
+    const uint64_t last_word = (chunk->pos + chunk->nb_bases - 1) / GENOME_BASES_PER_WORD;
+    uint64_t pos = chunk->pos;
+    uint64_t word = 0ULL;
+
+    for (uint64_t line = chunk->start; line < chunk->end;) {
+        uint64_t line_end = line;
+        while (line_end < chunk->end && !is_end_of_line(fasta[line_end]) && line_end - line < FASTA_ENCODE_SIZE) {
+            line_end++;
+        }
+        /* A -> 0, C -> 1, G -> 3, T -> 2, N -> 4 */
+        nucleotide_encode(&fasta[line], line_end - line, bases, NULL, true);
+        for (uint64_t i = 0; i < line_end - line; i++, pos++) {
+            if (bases[i] == GENOME_CODE_N) {
+                fasta_chunk_add_n(chunk, pos);
+            } else {
+                word |= (uint64_t)bases[i] << ((pos % GENOME_BASES_PER_WORD) * 2);
+            }
+            if ((pos + 1) % GENOME_BASES_PER_WORD == 0 || pos + 1 == chunk->pos + chunk->nb_bases) {
+                /* The first and last words of the chunk can be shared with the neighbouring chunks */
+                uint64_t word_idx = pos / GENOME_BASES_PER_WORD;
+                if (word_idx == first_word || word_idx == last_word) {
+                    __sync_fetch_and_or(&genome.packed[word_idx], word);
+                } else {
+                    genome.packed[word_idx] = word;
+                }
+                word = 0ULL;
+            }
+        }
+        line = line_end;
+        while (line < chunk->end && is_end_of_line(fasta[line])) {
+            line++;
+        }
+    }
+    assert(pos == chunk->pos + chunk->nb_bases);
+}
+
+static void genome_create_count(int thread_id)
+{
+    pthread_barrier_wait(&barrier);
+    for (unsigned int each_chunk = thread_id; each_chunk < nb_fasta_chunks; each_chunk += GENOME_THREAD) {
+        fasta_chunk_count(&fasta_chunks[each_chunk]);
+    }
+    pthread_barrier_wait(&barrier);
+}
+
+static void genome_create_encode(int thread_id)
+{
+    pthread_barrier_wait(&barrier);
+    for (unsigned int each_chunk = thread_id; each_chunk < nb_fasta_chunks; each_chunk += GENOME_THREAD) {
+        if (fasta_chunks[each_chunk].nb_bases != 0) {
+            fasta_chunk_encode(&fasta_chunks[each_chunk]);
+        }
+    }
+    pthread_barrier_wait(&barrier);
+}
+
+static void *genome_create_slave_fct(void *args)
+{
+    uint32_t thread_id = (uint32_t)(uintptr_t)args;
+
+    genome_create_count(thread_id);
+    genome_create_encode(thread_id);
+
+    return NULL;
+}
+
+/**
+ * @brief Find the sequences of the fasta file and cut their bodies in chunks.
+ */
+static void fasta_split(size_t fasta_size)
+{
+    unsigned int max_fasta_chunks = 0;
+    nb_fasta_chunks = 0;
+    genome.nb_seq = 0;
+
+    const char *header = memchr(fasta, '>', fasta_size);
+    while (header != NULL) {
+        const char *header_end = memchr(header, '\n', &fasta[fasta_size] - header);
+        uint64_t body_start = header_end == NULL ? fasta_size : (uint64_t)(header_end - fasta) + 1;
+        const char *next_header = body_start == fasta_size ? NULL : memchr(&fasta[body_start], '>', fasta_size - body_start);
+        uint64_t body_end = next_header == NULL ? fasta_size : (uint64_t)(next_header - fasta);
+
+        if (genome.nb_seq == MAX_SEQ_GEN) {
+            ERROR_EXIT(ERR_INPUT_CORRUPTED, "%s: more than %u sequences in the reference genome", __func__, MAX_SEQ_GEN);
+        }
+        size_t name_len = body_start - (header - fasta) - 1;
+        while (name_len != 0 && is_end_of_line(header[name_len])) {
+            name_len--;
+        }
+        memcpy(genome.seq_name[genome.nb_seq], &header[1], name_len > MAX_SEQ_NAME_SIZE ? MAX_SEQ_NAME_SIZE : name_len);
+
+        for (uint64_t chunk_start = body_start; chunk_start < body_end; chunk_start += FASTA_CHUNK_SIZE) {
+            if (nb_fasta_chunks == max_fasta_chunks) {
+                max_fasta_chunks = max_fasta_chunks == 0 ? 1024 : max_fasta_chunks * 2;
+                fasta_chunks = (fasta_chunk_t *)realloc(fasta_chunks, max_fasta_chunks * sizeof(fasta_chunk_t));
+                assert(fasta_chunks != NULL);
+            }
+            fasta_chunks[nb_fasta_chunks++] = (fasta_chunk_t) {
+                .start = chunk_start,
+                .end = chunk_start + FASTA_CHUNK_SIZE < body_end ? chunk_start + FASTA_CHUNK_SIZE : body_end,
+                .seq = genome.nb_seq,
+            };
+        }
+        genome.nb_seq++;
+        header = next_header;
+    }
+}
+
 void genome_create()
 {
     char *prefix = get_input_path();
-    char genome_file_line[MAX_BUF_SIZE];
+    pthread_t thread_id[GENOME_THREAD_SLAVE];
 
     double start_time = my_clock();
 
@@ -64,37 +310,69 @@ void genome_create()
     sprintf(filename, "%s.fasta", prefix);
     FILE *genome_file = fopen(filename, "r");
     CHECK_FILE(genome_file, filename);
+    size_t fasta_size;
+    fasta = (const char *)map_file(genome_file, &fasta_size);
+    fclose(genome_file);
+    madvise((void *)fasta, fasta_size, MADV_SEQUENTIAL);
 
-    fseek(genome_file, 0, SEEK_END);
-    genome.fasta_file_size = ftell(genome_file);
-    rewind(genome_file);
+    fasta_split(fasta_size);
 
-    genome.data = (int8_t *)malloc(sizeof(int8_t) * genome.fasta_file_size);
-    assert(genome.data != NULL);
-    genome.nb_seq = 0;
+    assert(pthread_barrier_init(&barrier, NULL, GENOME_THREAD) == 0);
+    for (unsigned int each_thread = 0; each_thread < GENOME_THREAD_SLAVE; each_thread++) {
+        assert(pthread_create(&thread_id[each_thread], NULL, genome_create_slave_fct, (void *)(uintptr_t)each_thread) == 0);
+    }
+
+    genome_create_count(GENOME_THREAD_SLAVE);
+
+    genome.nb_bases = 0;
+    for (uint32_t each_seq = 0; each_seq < genome.nb_seq; each_seq++) {
+        genome.len_seq[each_seq] = 0;
+    }
+    for (unsigned int each_chunk = 0; each_chunk < nb_fasta_chunks; each_chunk++) {
+        fasta_chunk_t *chunk = &fasta_chunks[each_chunk];
+        if (each_chunk == 0 || fasta_chunks[each_chunk - 1].seq != chunk->seq) {
+            genome.pt_seq[chunk->seq] = genome.nb_bases;
+        }
+        chunk->pos = genome.nb_bases;
+        genome.len_seq[chunk->seq] += chunk->nb_bases;
+        genome.nb_bases += chunk->nb_bases;
+    }
+    genome.packed = (uint64_t *)calloc(genome_nb_packed_words(genome.nb_bases), sizeof(uint64_t));
+    genome.n_blocks = (uint64_t *)calloc(genome_nb_n_blocks_words(genome.nb_bases), sizeof(uint64_t));
+    assert(genome.packed != NULL && genome.n_blocks != NULL);
     genome.mapping_coverage = NULL;
 
-    uint64_t current_data_idx = 0;
-    while (fgets(genome_file_line, MAX_BUF_SIZE, genome_file) != NULL) {
-        if (genome_file_line[0] == '>') { /* Commentary line with metadata */
-            genome.pt_seq[genome.nb_seq] = current_data_idx;
-            genome.len_seq[genome.nb_seq] = 0;
-            genome_file_line[strlen(genome_file_line) - 1] = '\0';
-            memcpy(genome.seq_name[genome.nb_seq], &genome_file_line[1],
-                strlen(&genome_file_line[1]) > MAX_SEQ_NAME_SIZE ? MAX_SEQ_NAME_SIZE : strlen(&genome_file_line[1]));
-            genome.nb_seq++;
-        } else {
-            for (unsigned int i = 0; i < strlen(genome_file_line) - 1; i++) {
-                if (genome_file_line[i] != 'N') { /* A -> 0, C -> 1, G -> 3, T -> 2 */
-                    genome.data[current_data_idx++] = (((int)genome_file_line[i]) >> 1) & 3;
-                } else {
-                    genome.data[current_data_idx++] = 4;
-                }
-                genome.len_seq[genome.nb_seq - 1]++;
+    genome_create_encode(GENOME_THREAD_SLAVE);
+
+    for (unsigned int each_thread = 0; each_thread < GENOME_THREAD_SLAVE; each_thread++) {
+        assert(pthread_join(thread_id[each_thread], NULL) == 0);
+    }
+    assert(pthread_barrier_destroy(&barrier) == 0);
+    munmap((void *)fasta, fasta_size);
+
+    /* Gather the runs of 'N' of the chunks, merging the runs that continue in the next chunk */
+    uint64_t max_n_runs = 0;
+    for (unsigned int each_chunk = 0; each_chunk < nb_fasta_chunks; each_chunk++) {
+        max_n_runs += fasta_chunks[each_chunk].nb_n_runs;
+    }
+    genome.n_runs = (genome_n_run_t *)malloc((max_n_runs + 1) * sizeof(genome_n_run_t));
+    assert(genome.n_runs != NULL);
+    genome.nb_n_runs = 0;
+    for (unsigned int each_chunk = 0; each_chunk < nb_fasta_chunks; each_chunk++) {
+        fasta_chunk_t *chunk = &fasta_chunks[each_chunk];
+        for (uint64_t each_run = 0; each_run < chunk->nb_n_runs; each_run++) {
+            if (genome.nb_n_runs != 0
+                && genome.n_runs[genome.nb_n_runs - 1].start + genome.n_runs[genome.nb_n_runs - 1].len
+                    == chunk->n_runs[each_run].start) {
+                genome.n_runs[genome.nb_n_runs - 1].len += chunk->n_runs[each_run].len;
+            } else {
+                genome.n_runs[genome.nb_n_runs++] = chunk->n_runs[each_run];
             }
         }
+        free(chunk->n_runs);
     }
-    fclose(genome_file);
+    free(fasta_chunks);
+    fasta_chunks = NULL;
 
     char *index_folder = get_index_folder();
     sprintf(filename, "%s" GENOME_BINARY, index_folder);
@@ -102,15 +380,34 @@ void genome_create()
     FILE *genome_binary = fopen(filename, "w");
     CHECK_FILE(genome_binary, filename);
     xfer_file((uint8_t *)&genome, sizeof(genome_t), genome_binary, xfer_write);
-    xfer_file((uint8_t *)genome.data, genome.fasta_file_size, genome_binary, xfer_write);
+    genome.packed_offset = xfer_file_align(genome_binary);
+    xfer_file((uint8_t *)genome.packed, genome_nb_packed_words(genome.nb_bases) * sizeof(uint64_t), genome_binary, xfer_write);
+    genome.n_blocks_offset = xfer_file_align(genome_binary);
+    xfer_file(
+        (uint8_t *)genome.n_blocks, genome_nb_n_blocks_words(genome.nb_bases) * sizeof(uint64_t), genome_binary, xfer_write);
+    genome.n_runs_offset = xfer_file_align(genome_binary);
+    if (genome.nb_n_runs != 0) {
+        xfer_file((uint8_t *)genome.n_runs, genome.nb_n_runs * sizeof(genome_n_run_t), genome_binary, xfer_write);
+    }
+    /* The offsets of the sections are only known once they have been written */
+    rewind(genome_binary);
+    xfer_file((uint8_t *)&genome, sizeof(genome_t), genome_binary, xfer_write);
     fclose(genome_binary);
 
-    printf("\t#seq: %d\n", genome.nb_seq);
+    printf("\t#seq: %d\n"
+           "\t#bases: %lu (%lu runs of N)\n",
+        genome.nb_seq, genome.nb_bases, genome.nb_n_runs);
     printf("\ttime: %lf s\n", my_clock() - start_time);
 }
 
 void genome_free()
 {
-    free(genome.data);
+    if (genome_mapping != NULL) {
+        munmap(genome_mapping, genome_mapping_size);
+    } else {
+        free(genome.packed);
+        free(genome.n_blocks);
+        free(genome.n_runs);
+    }
     free(genome.mapping_coverage);
 }
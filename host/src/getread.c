@@ -3,93 +3,770 @@
  */
 
 #include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "bgzf.h"
 #include "common.h"
+#include "dispatch.h"
 #include "getread.h"
+#include "index.h"
+#include "nucleotide.h"
 #include "upvc.h"
 
-#define MAX_SEQ_SIZE (512)
-#define MAX_BUF_SIZE (1024)
+#define GETREAD_THREAD (4)
+#define GETREAD_THREAD_SLAVE (GETREAD_THREAD - 1)
+#define MAX_RECORDS_PER_PASS (MAX_READS_BUFFER / 4)
+#define READ_CACHE_RAM_SIZE (1ULL << 30)
 
+static unsigned int size_read;
 static int nb_reads[NB_READS_BUFFER];
 static int8_t *reads_buffers[NB_READS_BUFFER];
 #define PASS(pass_id) (pass_id % NB_READS_BUFFER)
 
 /**
- * @brief Parse the file "f" to get the next read in the file and its pair.
+ * @brief Input file parsed in place.
  *
- * @param f          File to parse.
- * @param read1      Output the next read in the file.
- * @param read2      Output the pair of the next read in the file.
+ * Plain files are mapped in memory and parsed directly from the mapping. Compressed files and pipes are read in a window
+ * that is refilled when the parser reaches its end.
  *
- * @return The size of the read.
+ * @var data    Start of the data available to the parser (NULL if the file is empty).
+ * @var size    Size of the data available to the parser.
+ * @var cursor  Offset of the next line to parse.
+ * @var eof     Whether the data available ends with the end of the file.
+ * @var bf      Compressed file (NULL for plain files).
+ * @var stream  Plain file that cannot be mapped, like a pipe (NULL otherwise).
+ * @var window  Buffer holding the data read from compressed files and pipes.
  */
-static int get_seq_fast_AQ(FILE *f, int8_t *read1, int8_t *read2)
+typedef struct {
+    const char *data;
+    size_t size;
+    size_t cursor;
+    bool eof;
+    bgzf_file_t *bf;
+    FILE *stream;
+    char *window;
+} input_file_t;
+
+#define WINDOW_SIZE (16 << 20)
+
+static input_file_t input_pe1, input_pe2;
+
+/**
+ * @brief Record found by a parser thread.
+ *
+ * @var start     Offset of the first line of the record.
+ * @var sequence  Offset of the sequence line.
+ * @var len       Length of the sequence line.
+ * @var offset    Number of symbols to skip at the end of the read (see parse_record).
+ */
+typedef struct {
+    size_t start;
+    size_t sequence;
+    uint32_t len;
+    int32_t offset;
+} record_t;
+
+/**
+ * @brief Byte range of the input parsed by one thread.
+ *
+ * @var start       Start of the range (the start of a record for the first thread, any byte for the others).
+ * @var end         The records starting before "end" belong to the range.
+ * @var first       Offset of the first record found in the range.
+ * @var next        Offset following the last record found in the range.
+ * @var nb_records  Number of records found in the range.
+ * @var records     Records found in the range.
+ * @var read_idx    Index of the first record of the range among the records of the pass.
+ * @var nb_taken    Number of records of the range kept for the pass.
+ */
+typedef struct {
+    size_t start;
+    size_t end;
+    size_t first;
+    size_t next;
+    unsigned int nb_records;
+    record_t *records;
+    unsigned int read_idx;
+    unsigned int nb_taken;
+} chunk_t;
+
+/**
+ * @brief Read kept in the cache, 4 symbols per byte.
+ *
+ * @var nb_sym  Number of symbols of the read.
+ * @var offset  Number of symbols to skip at the end of the read (see parse_record).
+ * @var seq     Symbols of the read, the first one in the 2 low bits of the first byte.
+ */
+typedef struct {
+    uint8_t nb_sym;
+    uint8_t offset;
+    uint8_t seq[(SIZE_READ_MAX + 3) / 4];
+} packed_read_t;
+
+/**
+ * @brief Reads of a pass kept in the cache, PE1 of pair j at index 2j and PE2 at index 2j + 1.
+ *
+ * @var nb_pair       Number of pairs of reads of the pass.
+ * @var reads         Reads of the pass if they are kept in RAM, NULL if they are in the spill file.
+ * @var spill_offset  Offset of the reads of the pass in the spill file.
+ */
+typedef struct {
+    unsigned int nb_pair;
+    packed_read_t *reads;
+    long spill_offset;
+} cached_pass_t;
+
+/**
+ * @brief Cache of the reads parsed during the first run, replayed during the next runs.
+ *
+ * @var enabled       Whether the reads are kept in the cache.
+ * @var replaying     Whether get_reads gets the reads from the cache instead of the input files.
+ * @var passes        Reads of each pass.
+ * @var nb_passes     Number of passes in the cache.
+ * @var max_passes    Number of passes allocated in "passes".
+ * @var ram_size      Size of the reads kept in RAM.
+ * @var spill_file    File holding the reads that do not fit in READ_CACHE_RAM_SIZE (NULL until needed).
+ * @var spill_buffer  Buffer used to write and read the spill file.
+ */
+static struct {
+    bool enabled;
+    bool replaying;
+    cached_pass_t *passes;
+    unsigned int nb_passes;
+    unsigned int max_passes;
+    size_t ram_size;
+    FILE *spill_file;
+    packed_read_t *spill_buffer;
+} cache;
+
+static chunk_t chunks[GETREAD_THREAD];
+static input_file_t *curr_input;
+static bool curr_input_fasta;
+static unsigned int curr_pe;
+static int8_t *curr_reads_buffer;
+static packed_read_t *curr_packed_reads;
+static unsigned int curr_nb_pair;
+
+typedef void (*get_reads_thread_job_t)(unsigned int);
+static get_reads_thread_job_t thread_job;
+static pthread_barrier_t barrier;
+static pthread_t thread_id[GETREAD_THREAD_SLAVE];
+static bool stop_threads = false;
+
+static void input_open(input_file_t *in, FILE *f)
 {
-    static const int invnt[4] = { 2, 3, 0, 1 };
-    int offset = 0;
-    char comment[MAX_BUF_SIZE];
-    char sequence_buffer[MAX_SEQ_SIZE];
+    struct stat st;
 
-    if (fgets(comment, MAX_BUF_SIZE, f) == NULL) { /* Commentary */
-        return -1;
+    in->size = 0;
+    in->cursor = 0;
+    in->data = NULL;
+    in->eof = true;
+    in->window = NULL;
+    in->stream = NULL;
+    in->bf = bgzf_open(f);
+
+    fflush(f);
+    assert(fstat(fileno(f), &st) == 0);
+    if (in->bf != NULL || !S_ISREG(st.st_mode)) {
+        if (in->bf == NULL) {
+            in->stream = f;
+        }
+        in->window = (char *)malloc(WINDOW_SIZE);
+        assert(in->window != NULL);
+        in->data = in->window;
+        in->eof = false;
+        return;
+    }
+    if (st.st_size == 0) {
+        return;
+    }
+    in->size = (size_t)st.st_size;
+
+    void *data = mmap(NULL, in->size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    assert(data != MAP_FAILED);
+    madvise(data, in->size, MADV_SEQUENTIAL);
+    in->data = (const char *)data;
+}
+
+static void input_close(input_file_t *in)
+{
+    if (in->bf != NULL) {
+        bgzf_close(in->bf);
+    }
+    if (in->window != NULL) {
+        free(in->window);
+    } else if (in->data != NULL) {
+        munmap((void *)in->data, in->size);
+    }
+    in->data = NULL;
+    in->size = 0;
+    in->cursor = 0;
+    in->bf = NULL;
+    in->stream = NULL;
+    in->window = NULL;
+}
+
+static void input_rewind(input_file_t *in)
+{
+    if (in->stream != NULL) {
+        /* A pipe cannot be rewound, its reads are replayed from the cache */
+        return;
+    }
+    if (in->bf != NULL) {
+        bgzf_rewind(in->bf);
+        in->size = 0;
+        in->eof = false;
+    }
+    in->cursor = 0;
+}
+
+/**
+ * @brief Keep the data not parsed yet at the beginning of the window and inflate more data after it.
+ *
+ * @return The number of bytes added to the window, 0 at the end of the file (and always for mapped files).
+ */
+static size_t input_refill(input_file_t *in)
+{
+    if (in->eof) {
+        return 0;
+    }
+    size_t remaining = in->size - in->cursor;
+    memmove(in->window, &in->window[in->cursor], remaining);
+    in->cursor = 0;
+    size_t nb_bytes = (in->bf != NULL) ? bgzf_read(in->bf, &in->window[remaining], WINDOW_SIZE - remaining)
+                                        : fread(&in->window[remaining], 1, WINDOW_SIZE - remaining, in->stream);
+    in->size = remaining + nb_bytes;
+    if (nb_bytes < WINDOW_SIZE - remaining) {
+        in->eof = true;
+    }
+    return nb_bytes;
+}
+
+/**
+ * @brief Get the next line of the input file without copying it.
+ *
+ * The line stays valid until the next call on the same file.
+ *
+ * @param in    Input file to parse.
+ * @param line  Output the start of the line.
+ *
+ * @return The length of the line (without the '\n'), -1 at the end of the file.
+ */
+static long next_line(input_file_t *in, const char **line)
+{
+    const char *end = NULL;
+    while (in->cursor >= in->size || (end = (const char *)memchr(&in->data[in->cursor], '\n', in->size - in->cursor)) == NULL) {
+        if (input_refill(in) == 0) {
+            break;
+        }
     }
-    if (fgets(sequence_buffer, MAX_SEQ_SIZE, f) == NULL) { /* Sequence */
+    if (in->cursor >= in->size) {
         return -1;
     }
 
+    const char *start = &in->data[in->cursor];
+    size_t len = (end == NULL) ? in->size - in->cursor : (size_t)(end - start);
+
+    in->cursor += len + 1;
+    if (in->cursor > in->size) {
+        in->cursor = in->size;
+    }
+    *line = start;
+    return (long)len;
+}
+
+/**
+ * @brief Get the line starting at "offset" in the data available, without refilling it.
+ *
+ * @param in      Input file to parse.
+ * @param offset  Offset of the line.
+ * @param len     Output the length of the line (without the '\n').
+ *
+ * @return The offset of the next line, 0 if the line is not complete in the data available.
+ */
+static size_t line_at(input_file_t *in, size_t offset, size_t *len)
+{
+    if (offset >= in->size) {
+        return 0;
+    }
+    const char *end = (const char *)memchr(&in->data[offset], '\n', in->size - offset);
+    if (end == NULL) {
+        if (!in->eof) {
+            return 0;
+        }
+        *len = in->size - offset;
+        return in->size + 1;
+    }
+    *len = (size_t)(end - &in->data[offset]);
+    return offset + *len + 1;
+}
+
+/**
+ * @brief Encode a sequence line and its reverse complement.
+ *
+ * @param sequence  Sequence in ASCII (A, C, G, T).
+ * @param len       Number of characters available in "sequence".
+ * @param offset    Number of symbols to skip at the end of the read (see parse_record).
+ * @param read1     Output the encoded read.
+ * @param read2     Output the reverse complement of the encoded read.
+ *
+ * @return The number of symbols encoded.
+ */
+static int encode_read(const char *sequence, long len, int offset, int8_t *read1, int8_t *read2)
+{
+    int nb_sym = size_read - offset;
+    if (nb_sym > len) {
+        nb_sym = (int)len;
+    }
+
+    nucleotide_encode(sequence, nb_sym, read1, &read2[size_read - offset - nb_sym], false);
+    memset(&read1[nb_sym], 0, size_read - nb_sym);
+    memset(read2, 0, size_read - offset - nb_sym);
+    memset(&read2[size_read - offset], 0, offset);
+    return nb_sym;
+}
+
+static void pack_read(const int8_t *read, int nb_sym, int offset, packed_read_t *packed)
+{
+    packed->nb_sym = (uint8_t)nb_sym;
+    packed->offset = (uint8_t)offset;
+    memset(packed->seq, 0, sizeof(packed->seq));
+    for (int each_sym = 0; each_sym < nb_sym; each_sym++) {
+        packed->seq[each_sym / 4] |= (uint8_t)(read[each_sym] << (2 * (each_sym % 4)));
+    }
+}
+
+/**
+ * @brief Decode a read of the cache and its reverse complement, the same way encode_read does.
+ */
+static void unpack_read(const packed_read_t *packed, int8_t *read1, int8_t *read2)
+{
+    int nb_sym = packed->nb_sym;
+    int offset = packed->offset;
+    int8_t *rev = &read2[size_read - offset - 1];
+
+    for (int each_sym = 0; each_sym < nb_sym; each_sym++) {
+        int8_t code = (int8_t)((packed->seq[each_sym / 4] >> (2 * (each_sym % 4))) & 3);
+        read1[each_sym] = code;
+        rev[-each_sym] = code ^ 2;
+    }
+    memset(&read1[nb_sym], 0, size_read - nb_sym);
+    memset(read2, 0, size_read - offset - nb_sym);
+    memset(&read2[size_read - offset], 0, offset);
+}
+
+/**
+ * @brief Parse the record starting at "offset".
+ *
+ * A FASTQ record is made of 4 lines (commentary, sequence, commentary, quality), a FASTA record of 2 lines (commentary,
+ * sequence).
+ *
+ * @param in      Input file to parse.
+ * @param fasta   Whether the input file is a FASTA file.
+ * @param offset  Offset of the record.
+ * @param record  Output the record.
+ *
+ * @return The offset of the next record, 0 if the record is not complete in the data available.
+ */
+static size_t parse_record(input_file_t *in, bool fasta, size_t offset, record_t *record)
+{
+    size_t len;
+    size_t next;
+
+    if ((next = line_at(in, offset, &len)) == 0) { /* Commentary */
+        return 0;
+    }
+    record->start = offset;
+    record->offset = 0;
+
     /* If the comment start with ">>14"
      * it means that we need the skip the first 14 characters of the read.
      */
-    if (comment[1] == '>') {
-        sscanf(&comment[2], "%d", &offset);
+    if (len > 1 && in->data[offset + 1] == '>') {
+        record->offset = (int32_t)strtol(&in->data[offset + 2], NULL, 10);
+    }
+
+    record->sequence = next;
+    if ((next = line_at(in, next, &len)) == 0) { /* Sequence */
+        return 0;
+    }
+    record->len = (uint32_t)len;
+
+    if (fasta) {
+        return next;
+    }
+    if ((next = line_at(in, next, &len)) == 0) { /* Commentary */
+        return 0;
+    }
+    if ((next = line_at(in, next, &len)) == 0) { /* Line with sequence quality information (unused) */
+        return 0;
     }
-    int i;
-    for (i = 0; i < SIZE_READ - offset; i++) {
-        read1[i] = (((int)sequence_buffer[i]) >> 1) & 3;
-        read2[SIZE_READ - i - 1 - offset] = invnt[read1[i]];
+    return next;
+}
+
+/**
+ * @brief Find the first record starting in [offset, end[, return "end" if there is none.
+ *
+ * A quality line can start with '@' as well as a FASTQ commentary. A line starting with '@' is the start of a record if
+ * the second line after it (the second commentary) starts with '+'.
+ */
+static size_t resync_record(input_file_t *in, bool fasta, size_t offset, size_t end)
+{
+    size_t len, next, next2;
+
+    if (offset != 0 && in->data[offset - 1] != '\n') {
+        const char *eol = (const char *)memchr(&in->data[offset], '\n', end - offset);
+        offset = (eol == NULL) ? end : (size_t)(eol - in->data) + 1;
     }
-    for (; i < SIZE_READ; i++) {
-        read1[i] = 0;
-        read2[i] = 0;
+    while (offset < end) {
+        if (fasta) {
+            if (in->data[offset] == '>') {
+                return offset;
+            }
+        } else if (in->data[offset] == '@') {
+            next = line_at(in, offset, &len);
+            next2 = (next == 0) ? 0 : line_at(in, next, &len);
+            if (next2 == 0 || (next2 < in->size && in->data[next2] == '+')) {
+                return offset;
+            }
+        }
+        if ((next = line_at(in, offset, &len)) == 0) {
+            return end;
+        }
+        offset = next;
     }
+    return end;
+}
+
+static void find_records(unsigned int thread_id)
+{
+    chunk_t *chunk = &chunks[thread_id];
+    size_t offset = (thread_id == 0) ? chunk->start : resync_record(curr_input, curr_input_fasta, chunk->start, chunk->end);
 
-    if (comment[0] == '>') {
-        return SIZE_READ;
+    chunk->first = offset;
+    chunk->nb_records = 0;
+    while (offset < chunk->end && chunk->nb_records < MAX_RECORDS_PER_PASS) {
+        size_t next = parse_record(curr_input, curr_input_fasta, offset, &chunk->records[chunk->nb_records]);
+        if (next == 0) {
+            break;
+        }
+        chunk->nb_records++;
+        offset = next;
     }
-    if (fgets(comment, MAX_BUF_SIZE, f) == NULL) { /* Commentary */
-        return -1;
+    chunk->next = offset;
+}
+
+static void encode_records(unsigned int thread_id)
+{
+    chunk_t *chunk = &chunks[thread_id];
+
+    /* Reads are stored by pair: PE1, PE1 reverse complement, PE2, PE2 reverse complement */
+    for (unsigned int each_record = 0; each_record < chunk->nb_taken; each_record++) {
+        record_t *record = &chunk->records[each_record];
+        unsigned int num_pair = chunk->read_idx + each_record;
+        unsigned int num_read = num_pair * 4 + curr_pe * 2;
+        int nb_sym = encode_read(&curr_input->data[record->sequence], record->len, record->offset,
+            &curr_reads_buffer[num_read * size_read], &curr_reads_buffer[(num_read + 1) * size_read]);
+        if (cache.enabled) {
+            pack_read(&curr_reads_buffer[num_read * size_read], nb_sym, record->offset, &curr_packed_reads[num_pair * 2 + curr_pe]);
+        }
     }
-    if (fgets(sequence_buffer, MAX_SEQ_SIZE, f) == NULL) { /* Line with sequence quality information (unused) */
-        return -1;
+}
+
+static void unpack_records(unsigned int thread_id)
+{
+    unsigned int first_pair = (unsigned int)((uint64_t)curr_nb_pair * thread_id / GETREAD_THREAD);
+    unsigned int last_pair = (unsigned int)((uint64_t)curr_nb_pair * (thread_id + 1) / GETREAD_THREAD);
+
+    for (unsigned int each_pair = first_pair; each_pair < last_pair; each_pair++) {
+        for (unsigned int pe = 0; pe < 2; pe++) {
+            unsigned int num_read = each_pair * 4 + pe * 2;
+            unpack_read(&curr_packed_reads[each_pair * 2 + pe], &curr_reads_buffer[num_read * size_read],
+                &curr_reads_buffer[(num_read + 1) * size_read]);
+        }
+    }
+}
+
+static void *get_reads_thread_fct(void *arg)
+{
+    const unsigned int thread_id = (unsigned int)(uintptr_t)arg;
+
+    pthread_barrier_wait(&barrier);
+    while (!stop_threads) {
+        thread_job(thread_id);
+        pthread_barrier_wait(&barrier);
+        pthread_barrier_wait(&barrier);
+    }
+    return NULL;
+}
+
+static void run_threads(get_reads_thread_job_t job)
+{
+    thread_job = job;
+    pthread_barrier_wait(&barrier);
+    job(GETREAD_THREAD_SLAVE);
+    pthread_barrier_wait(&barrier);
+}
+
+/**
+ * @brief Size in bytes of the record at the cursor, used to estimate the size of the records following it.
+ */
+static size_t record_size_estimate(input_file_t *in, bool fasta)
+{
+    record_t record;
+    size_t next = parse_record(in, fasta, in->cursor, &record);
+    if (next == 0 || next > in->size) {
+        return in->size - in->cursor;
+    }
+    return next - in->cursor;
+}
+
+/**
+ * @brief Parse and encode up to "nb_records_max" records of "in" with the parser threads.
+ *
+ * Each round splits the data following the cursor into one byte range per thread. The threads look for the records of
+ * their range in parallel, the records are then numbered in the order of the file, and each thread encodes its records
+ * at their place in the reads buffer. The numbering stops at the first range that does not start where the previous one
+ * ends, so the next round starts again from there.
+ *
+ * @param in            Input file to parse.
+ * @param pe            0 for the PE1 file, 1 for the PE2 file.
+ * @param reads_buffer  Output the encoded reads.
+ * @param nb_records_max  Maximum number of records to parse.
+ *
+ * @return The number of records parsed.
+ */
+static unsigned int parse_records(input_file_t *in, unsigned int pe, int8_t *reads_buffer, unsigned int nb_records_max)
+{
+    unsigned int nb_records = 0;
+
+    curr_input = in;
+    curr_pe = pe;
+    curr_reads_buffer = reads_buffer;
+
+    while (nb_records < nb_records_max) {
+        if (in->size - in->cursor < WINDOW_SIZE / 2) {
+            input_refill(in);
+        }
+        if (in->cursor >= in->size) {
+            break;
+        }
+
+        curr_input_fasta = in->data[in->cursor] == '>';
+        size_t range_size = record_size_estimate(in, curr_input_fasta) * (nb_records_max - nb_records + 1);
+        size_t range_end = (in->size - in->cursor < range_size) ? in->size : in->cursor + range_size;
+        size_t chunk_size = (range_end - in->cursor + GETREAD_THREAD - 1) / GETREAD_THREAD;
+        for (unsigned int each_thread = 0; each_thread < GETREAD_THREAD; each_thread++) {
+            chunk_t *chunk = &chunks[each_thread];
+            chunk->start = in->cursor + each_thread * chunk_size;
+            chunk->end = chunk->start + chunk_size;
+            if (chunk->start > range_end) {
+                chunk->start = range_end;
+            }
+            if (chunk->end > range_end) {
+                chunk->end = range_end;
+            }
+            chunk->nb_taken = 0;
+        }
+
+        run_threads(find_records);
+
+        unsigned int nb_records_round = 0;
+        size_t cursor = in->cursor;
+        for (unsigned int each_thread = 0; each_thread < GETREAD_THREAD && nb_records < nb_records_max; each_thread++) {
+            chunk_t *chunk = &chunks[each_thread];
+            if (chunk->first != cursor) {
+                break;
+            }
+            chunk->read_idx = nb_records;
+            chunk->nb_taken = chunk->nb_records;
+            if (chunk->nb_taken > nb_records_max - nb_records) {
+                chunk->nb_taken = nb_records_max - nb_records;
+                cursor = chunk->records[chunk->nb_taken].start;
+            } else {
+                cursor = chunk->next;
+            }
+            nb_records += chunk->nb_taken;
+            nb_records_round += chunk->nb_taken;
+        }
+
+        run_threads(encode_records);
+
+        in->cursor = (cursor > in->size) ? in->size : cursor;
+        if (nb_records_round == 0 && input_refill(in) == 0) {
+            break;
+        }
     }
-    return SIZE_READ;
+
+    return nb_records;
+}
+
+#define PACKED_PASS_SIZE (sizeof(packed_read_t) * MAX_RECORDS_PER_PASS * 2)
+
+/**
+ * @brief Get the buffer where to pack the reads of the next pass: in RAM while the cache holds less than
+ * READ_CACHE_RAM_SIZE, in the spill buffer otherwise.
+ */
+static packed_read_t *cache_pass_buffer()
+{
+    if (cache.ram_size + PACKED_PASS_SIZE <= READ_CACHE_RAM_SIZE) {
+        packed_read_t *reads = (packed_read_t *)malloc(PACKED_PASS_SIZE);
+        assert(reads != NULL);
+        return reads;
+    }
+    if (cache.spill_buffer == NULL) {
+        static const char spill_filename[] = "reads_cache.bin";
+        cache.spill_file = fopen(spill_filename, "w+");
+        assert(cache.spill_file != NULL);
+        assert(unlink(spill_filename) == 0);
+        cache.spill_buffer = (packed_read_t *)malloc(PACKED_PASS_SIZE);
+        assert(cache.spill_buffer != NULL);
+    }
+    return cache.spill_buffer;
+}
+
+static void cache_add_pass(packed_read_t *reads, unsigned int nb_pair)
+{
+    if (cache.nb_passes == cache.max_passes) {
+        cache.max_passes = (cache.max_passes == 0) ? 16 : cache.max_passes * 2;
+        cache.passes = (cached_pass_t *)realloc(cache.passes, sizeof(cached_pass_t) * cache.max_passes);
+        assert(cache.passes != NULL);
+    }
+    cached_pass_t *pass = &cache.passes[cache.nb_passes++];
+    pass->nb_pair = nb_pair;
+    pass->reads = NULL;
+    pass->spill_offset = 0;
+
+    if (reads == cache.spill_buffer) {
+        pass->spill_offset = ftell(cache.spill_file);
+        size_t written_size = fwrite(reads, sizeof(packed_read_t) * 2, nb_pair, cache.spill_file);
+        assert(written_size == nb_pair);
+    } else if (nb_pair == 0) {
+        free(reads);
+    } else {
+        pass->reads = (packed_read_t *)realloc(reads, sizeof(packed_read_t) * nb_pair * 2);
+        assert(pass->reads != NULL);
+        cache.ram_size += sizeof(packed_read_t) * nb_pair * 2;
+    }
+}
+
+static unsigned int cache_replay_pass(unsigned int pass_id, int8_t *reads_buffer)
+{
+    if (pass_id >= cache.nb_passes) {
+        return 0;
+    }
+    cached_pass_t *pass = &cache.passes[pass_id];
+    curr_packed_reads = pass->reads;
+    if (pass->reads == NULL && pass->nb_pair != 0) {
+        assert(fseek(cache.spill_file, pass->spill_offset, SEEK_SET) == 0);
+        size_t read_size = fread(cache.spill_buffer, sizeof(packed_read_t) * 2, pass->nb_pair, cache.spill_file);
+        assert(read_size == pass->nb_pair);
+        curr_packed_reads = cache.spill_buffer;
+    }
+
+    curr_reads_buffer = reads_buffer;
+    curr_nb_pair = pass->nb_pair;
+    run_threads(unpack_records);
+
+    return pass->nb_pair;
+}
+
+static void cache_free()
+{
+    for (unsigned int each_pass = 0; each_pass < cache.nb_passes; each_pass++) {
+        free(cache.passes[each_pass].reads);
+    }
+    free(cache.passes);
+    free(cache.spill_buffer);
+    if (cache.spill_file != NULL) {
+        fclose(cache.spill_file);
+    }
+    memset(&cache, 0, sizeof(cache));
 }
 
-void get_reads(FILE *fpe1, FILE *fpe2, unsigned int pass_id)
+void get_reads_init(FILE *fpe1, FILE *fpe2, bool replay)
 {
-    int nb_read = 0;
-    pass_id = PASS(pass_id);
+    size_read = index_get_size_read();
+    input_open(&input_pe1, fpe1);
+    input_open(&input_pe2, fpe2);
 
-    int8_t *reads_buffer = reads_buffers[pass_id];
+    memset(&cache, 0, sizeof(cache));
+    cache.enabled = replay;
+
+    for (unsigned int each_thread = 0; each_thread < GETREAD_THREAD; each_thread++) {
+        chunks[each_thread].records = (record_t *)malloc(sizeof(record_t) * MAX_RECORDS_PER_PASS);
+        assert(chunks[each_thread].records != NULL);
+    }
+
+    stop_threads = false;
+    assert(pthread_barrier_init(&barrier, NULL, GETREAD_THREAD) == 0);
+    for (unsigned int each_thread = 0; each_thread < GETREAD_THREAD_SLAVE; each_thread++) {
+        assert(pthread_create(&thread_id[each_thread], NULL, get_reads_thread_fct, (void *)(uintptr_t)each_thread) == 0);
+    }
+}
+
+void get_reads_rewind()
+{
+    if (cache.enabled) {
+        cache.replaying = true;
+        return;
+    }
+    input_rewind(&input_pe1);
+    input_rewind(&input_pe2);
+}
+
+void get_reads_free()
+{
+    stop_threads = true;
+    pthread_barrier_wait(&barrier);
+    for (unsigned int each_thread = 0; each_thread < GETREAD_THREAD_SLAVE; each_thread++) {
+        assert(pthread_join(thread_id[each_thread], NULL) == 0);
+    }
+    assert(pthread_barrier_destroy(&barrier) == 0);
+
+    for (unsigned int each_thread = 0; each_thread < GETREAD_THREAD; each_thread++) {
+        free(chunks[each_thread].records);
+    }
+
+    cache_free();
+    input_close(&input_pe1);
+    input_close(&input_pe2);
+}
+
+void get_reads(unsigned int pass_id)
+{
+    unsigned int buffer_id = PASS(pass_id);
+    unsigned int nb_pair;
+
+    int8_t *reads_buffer = reads_buffers[buffer_id];
     if (reads_buffer == NULL) {
-        reads_buffer = (int8_t *)malloc(MAX_READS_BUFFER * SIZE_READ);
+        reads_buffer = (int8_t *)malloc(MAX_READS_BUFFER * size_read);
         assert(reads_buffer != NULL);
-        reads_buffers[pass_id] = reads_buffer;
+        reads_buffers[buffer_id] = reads_buffer;
     }
 
-    while (nb_read < MAX_READS_BUFFER) {
-        if ((get_seq_fast_AQ(fpe1, &reads_buffer[(nb_read + 0) * SIZE_READ], &reads_buffer[(nb_read + 1) * SIZE_READ]) <= 0)
-            || (get_seq_fast_AQ(fpe2, &reads_buffer[(nb_read + 2) * SIZE_READ], &reads_buffer[(nb_read + 3) * SIZE_READ]) <= 0))
-            break;
-        nb_read += 4;
+    if (cache.replaying) {
+        nb_pair = cache_replay_pass(pass_id, reads_buffer);
+    } else {
+        if (cache.enabled) {
+            assert(pass_id == cache.nb_passes);
+            curr_packed_reads = cache_pass_buffer();
+        }
+        nb_pair = parse_records(&input_pe1, 0, reads_buffer, dispatch_get_pass_size(pass_id) / 4);
+        nb_pair = parse_records(&input_pe2, 1, reads_buffer, nb_pair);
+        if (cache.enabled) {
+            cache_add_pass(curr_packed_reads, nb_pair);
+        }
     }
 
-    nb_reads[pass_id] = nb_read;
+    nb_reads[buffer_id] = nb_pair * 4;
 }
 
 int get_reads_in_buffer(unsigned int pass_id) { return nb_reads[PASS(pass_id)]; }
@@ -98,23 +775,39 @@ int8_t *get_reads_buffer(unsigned int pass_id) { return reads_buffers[PASS(pass_
 
 int get_input_info(FILE *f, size_t *read_size, size_t *nb_read)
 {
-    size_t size;
-    char sequence_buffer[MAX_SEQ_SIZE];
+    input_file_t in;
+    const char *line;
+    long len;
+    struct stat st;
+    uint8_t magic[2];
+
+    /* Counting the reads of a pipe would consume them, and counting the reads of a compressed file would inflate it twice */
+    assert(fstat(fileno(f), &st) == 0);
+    if (!S_ISREG(st.st_mode)) {
+        return 1;
+    }
+    if (pread(fileno(f), magic, sizeof(magic), 0) == sizeof(magic) && magic[0] == 0x1f && magic[1] == 0x8b) {
+        return 1;
+    }
 
-    if (fgets(sequence_buffer, MAX_SEQ_SIZE, f) == NULL) { /* Commentary */
+    input_open(&in, f);
+    if (next_line(&in, &line) < 0) { /* Commentary */
+        input_close(&in);
         return -1;
     }
-    if (fgets(sequence_buffer, MAX_SEQ_SIZE, f) == NULL) { /* Sequence */
+    unsigned int nb_line_per_read = (line[0] == '>') ? 2 : 4;
+    if ((len = next_line(&in, &line)) < 0) { /* Sequence */
+        input_close(&in);
         return -1;
     }
-    size = strlen(sequence_buffer) - 1;
-
-    fseek(f, 0, SEEK_END);
-    size_t file_size = ftell(f);
+    *read_size = (size_t)len;
+    for (unsigned int each_line = 2; each_line < nb_line_per_read; each_line++) {
+        next_line(&in, &line); /* Separator and quality */
+    }
 
-    *read_size = size;
-    *nb_read = file_size / (2 * size);
+    /* Estimate the number of reads from the size of the first one: the accumulation grows if there are more */
+    *nb_read = in.size / in.cursor;
 
-    rewind(f);
+    input_close(&in);
     return 0;
 }
@@ -12,7 +12,6 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -22,12 +21,9 @@
 
 #include "common.h"
 
-#define CODE_SIZE (4)
-#define MASK (CODE_SIZE - 1)
-
-int code_seed(int8_t *sequence)
+int64_t code_seed(int8_t *sequence)
 {
-    int seed = 0;
+    int64_t seed = 0;
     for (int i = 0; i < SIZE_SEED; i++) {
         if (sequence[i] >= CODE_SIZE) {
             return -1;
@@ -37,35 +33,55 @@ int code_seed(int8_t *sequence)
     return seed;
 }
 
-void code_neighbour(int8_t *sequence, int8_t *code)
-{
-    for (int i = 0; i < SIZE_NEIGHBOUR_IN_BYTES; i++) {
-        int j = i * 4;
-        code[i] = ((sequence[j + 3] & MASK) * (CODE_SIZE * CODE_SIZE * CODE_SIZE))
-            + ((sequence[j + 2] & MASK) * (CODE_SIZE * CODE_SIZE)) + ((sequence[j + 1] & MASK) * (CODE_SIZE))
-            + ((sequence[j] & MASK));
-    }
-}
+#define NB_SEED ((int64_t)1 << (SIZE_SEED << 1)) /* NB_SEED = 4 ^ (SIZE_SEED) */
 
-void index_copy_neighbour(int8_t *dst, int8_t *src) { code_neighbour(&src[SIZE_SEED], dst); }
+#define MAX_SIZE_IDX_SEED (1000)
 
-#define NB_SEED (1 << (SIZE_SEED << 1)) /* NB_SEED = 4 ^ (SIZE_SEED) */
+#define MIN(a, b) ((a) > (b) ? (b) : (a))
+#define MAX(a, b) ((a) < (b) ? (b) : (a))
 
-#define MAX_SIZE_IDX_SEED (1000)
+/**
+ * @brief Block of the directory of the seeds.
+ *
+ * The directory tells which seeds occur in the reference with one bit per seed, and gives the rank of each occurring seed
+ * among the occurring seeds, so that only the occurring seeds need an offset in the index.
+ *
+ * @var rank      Number of occurring seeds before the first seed of the block.
+ * @var occupied  One bit per seed of the block, set if the seed occurs in the reference.
+ */
+#define SEED_DIRECTORY_BLOCK_SIZE (256)
+typedef struct seed_directory_block {
+    uint64_t rank;
+    uint64_t occupied[SEED_DIRECTORY_BLOCK_SIZE / 64];
+} seed_directory_block_t;
+#define NB_SEED_DIRECTORY_BLOCK ((NB_SEED + SEED_DIRECTORY_BLOCK_SIZE - 1) / SEED_DIRECTORY_BLOCK_SIZE)
 
+/**
+ * @brief Header of the index file.
+ *
+ * The header is followed by three sections, each one starting at an offset of the file aligned on FILE_SECTION_ALIGNMENT
+ * so that the index can be used directly from a mapping of the file:
+ *  - the NB_SEED_DIRECTORY_BLOCK blocks of the directory (seed_directory_block_t),
+ *  - the nb_seed_occupied + 1 offsets of the occurring seeds (uint32_t),
+ *  - the nb_seed_total chunks (index_seed_t).
+ */
 typedef struct hashtable_header {
     uint32_t magic;
     uint32_t version;
     uint32_t size_read;
     uint32_t size_seed;
     uint32_t nb_dpus;
-    uint32_t unused;
+    uint32_t nb_seed_occupied;
     uint64_t nb_seed_total;
+    uint64_t seed_directory_offset;
+    uint64_t seed_offsets_offset;
+    uint64_t index_seed_offset;
 } hashtable_header_t;
 
-#define INDEX_VERSION 1
-static hashtable_header_t hashtable_header
-    = { .magic = 0x1dec, .version = INDEX_VERSION, .size_read = SIZE_READ, .size_seed = SIZE_SEED };
+#define INDEX_VERSION 4
+static hashtable_header_t hashtable_header = { .magic = 0x1dec, .version = INDEX_VERSION, .size_read = 0, .size_seed = SIZE_SEED };
+
+unsigned int index_get_size_read() { return hashtable_header.size_read; }
 
 static char *get_index_filename()
 {
@@ -79,20 +95,135 @@ static char *get_index_filename()
 static unsigned int nb_indexed_dpu;
 unsigned int index_get_nb_dpu() { return nb_indexed_dpu; }
 
+/* The chunks of the occurring seed of rank "seed_rank" (see seed_directory_get_rank) are
+ * index_seed[seed_offsets[seed_rank]] to index_seed[seed_offsets[seed_rank + 1] - 1] */
+static seed_directory_block_t *seed_directory;
+static uint32_t *seed_offsets;
 static index_seed_t *index_seed;
 
-index_seed_t *index_get(int8_t *read)
+/* Mapping of the index file when the index has been loaded */
+static uint8_t *index_mapping;
+static size_t index_mapping_size;
+
+static inline seed_directory_block_t *seed_directory_get_block(int64_t seed_code)
+{
+    return &seed_directory[seed_code / SEED_DIRECTORY_BLOCK_SIZE];
+}
+
+static inline bool seed_directory_get_rank(int64_t seed_code, uint32_t *seed_rank)
+{
+    seed_directory_block_t *block = seed_directory_get_block(seed_code);
+    unsigned int seed_idx = seed_code % SEED_DIRECTORY_BLOCK_SIZE;
+    uint64_t occupied = block->occupied[seed_idx / 64];
+    uint64_t seed_mask = 1ULL << (seed_idx % 64);
+    if ((occupied & seed_mask) == 0) {
+        return false;
+    }
+
+    uint64_t rank = block->rank + __builtin_popcountll(occupied & (seed_mask - 1));
+    for (unsigned int each_word = 0; each_word < seed_idx / 64; each_word++) {
+        rank += __builtin_popcountll(block->occupied[each_word]);
+    }
+    *seed_rank = rank;
+    return true;
+}
+
+static unsigned int index_get_by_rank(bool occurring, uint32_t seed_rank, index_seed_t **seeds)
+{
+    if (!occurring) {
+        *seeds = index_seed;
+        return 0;
+    }
+    *seeds = &index_seed[seed_offsets[seed_rank]];
+    return seed_offsets[seed_rank + 1] - seed_offsets[seed_rank];
+}
+
+unsigned int index_get(int8_t *read, index_seed_t **seeds)
 {
-    index_seed_t *seed = &index_seed[code_seed(read)];
-    if (seed->nb_nbr == 0 && seed->next == NULL)
-        return NULL;
-    else
-        return seed;
+    uint32_t seed_rank;
+    bool occurring = seed_directory_get_rank(code_seed(read), &seed_rank);
+    return index_get_by_rank(occurring, seed_rank, seeds);
+}
+
+void index_get_batch(int8_t *reads, size_t stride, unsigned int nb_read, index_seed_t **seeds, unsigned int *nb_seeds)
+{
+    int64_t seed_codes[INDEX_BATCH_SIZE];
+    uint32_t seed_ranks[INDEX_BATCH_SIZE];
+    bool occurring[INDEX_BATCH_SIZE];
+    assert(nb_read <= INDEX_BATCH_SIZE);
+
+    for (unsigned int each_read = 0; each_read < nb_read; each_read++) {
+        seed_codes[each_read] = code_seed(&reads[each_read * stride]);
+        __builtin_prefetch(seed_directory_get_block(seed_codes[each_read]));
+    }
+    for (unsigned int each_read = 0; each_read < nb_read; each_read++) {
+        occurring[each_read] = seed_directory_get_rank(seed_codes[each_read], &seed_ranks[each_read]);
+        if (occurring[each_read]) {
+            __builtin_prefetch(&seed_offsets[seed_ranks[each_read]]);
+        }
+    }
+    for (unsigned int each_read = 0; each_read < nb_read; each_read++) {
+        nb_seeds[each_read] = index_get_by_rank(occurring[each_read], seed_ranks[each_read], &seeds[each_read]);
+        if (nb_seeds[each_read] != 0) {
+            __builtin_prefetch(seeds[each_read]);
+        }
+    }
+}
+
+#define INDEX_BENCH_NB_LOOKUP (1 << 24)
+
+static uint64_t index_bench_walk(index_seed_t *seeds, unsigned int nb_seeds)
+{
+    uint64_t nb_nbr = 0;
+    for (unsigned int each_seed = 0; each_seed < nb_seeds; each_seed++) {
+        nb_nbr += seeds[each_seed].nb_nbr + seeds[each_seed].num_dpu;
+    }
+    return nb_nbr;
+}
+
+void index_bench()
+{
+    printf("%s:\n", __func__);
+    int8_t *seeds = (int8_t *)malloc((size_t)INDEX_BENCH_NB_LOOKUP * SIZE_SEED);
+    assert(seeds != NULL);
+    unsigned int random_state = 1;
+    for (size_t each_symbol = 0; each_symbol < (size_t)INDEX_BENCH_NB_LOOKUP * SIZE_SEED; each_symbol++) {
+        seeds[each_symbol] = (int8_t)(rand_r(&random_state) & CODE_MASK);
+    }
+
+    uint64_t nb_nbr_single = 0;
+    double start_time = my_clock();
+    for (unsigned int each_lookup = 0; each_lookup < INDEX_BENCH_NB_LOOKUP; each_lookup++) {
+        index_seed_t *seed;
+        unsigned int nb_seeds = index_get(&seeds[each_lookup * SIZE_SEED], &seed);
+        nb_nbr_single += index_bench_walk(seed, nb_seeds);
+    }
+    double time_single = my_clock() - start_time;
+
+    uint64_t nb_nbr_batch = 0;
+    start_time = my_clock();
+    for (unsigned int each_lookup = 0; each_lookup < INDEX_BENCH_NB_LOOKUP; each_lookup += INDEX_BATCH_SIZE) {
+        index_seed_t *batch[INDEX_BATCH_SIZE];
+        unsigned int nb_seeds[INDEX_BATCH_SIZE];
+        index_get_batch(&seeds[each_lookup * SIZE_SEED], SIZE_SEED, INDEX_BATCH_SIZE, batch, nb_seeds);
+        for (unsigned int each_seed = 0; each_seed < INDEX_BATCH_SIZE; each_seed++) {
+            nb_nbr_batch += index_bench_walk(batch[each_seed], nb_seeds[each_seed]);
+        }
+    }
+    double time_batch = my_clock() - start_time;
+    assert(nb_nbr_single == nb_nbr_batch);
+
+    printf("\tlookups: %u\n"
+           "\tone at a time: %.2f Mlookups/s\n"
+           "\tby batch of %u: %.2f Mlookups/s (x%.2f)\n",
+        INDEX_BENCH_NB_LOOKUP, INDEX_BENCH_NB_LOOKUP / time_single / 1e6, INDEX_BATCH_SIZE,
+        INDEX_BENCH_NB_LOOKUP / time_batch / 1e6, time_single / time_batch);
+    free(seeds);
 }
 
 typedef struct seed_counter {
     int nb_seed;
-    int seed_code;
+    uint32_t seed_rank;
 } seed_counter_t;
 
 static int cmp_seed_counter(void const *a, void const *b)
@@ -113,35 +244,36 @@ void index_load()
     FILE *f = fopen(get_index_filename(), "r");
     CHECK_FILE(f, get_index_filename());
 
+    index_mapping = map_file(f, &index_mapping_size);
+    fclose(f);
+
     hashtable_header_t header;
-    xfer_file((uint8_t *)&header, sizeof(header), f, xfer_read);
+    assert(index_mapping_size >= sizeof(header));
+    memcpy(&header, index_mapping, sizeof(header));
     assert(header.magic == hashtable_header.magic
         && "Wrong header, make sure you have generated your MRAMs with the same version of UPVC that you are "
            "using.");
     assert(header.version == hashtable_header.version && "Could not load an index generated with a different version of UPVC.");
-    assert(header.size_read == hashtable_header.size_read && "Could not load an index generated with a different size of read.");
+    if (!size_read_supported(header.size_read)) {
+        ERROR_EXIT(ERR_SIZE_READ_NOT_SUPPORTED, "Could not load an index generated for reads of %u symbols.", header.size_read);
+    }
+    hashtable_header.size_read = header.size_read;
     assert(header.size_seed == hashtable_header.size_seed && "Could not load an index generated with a different size of seed.");
 
-    index_seed = (index_seed_t *)malloc(header.nb_seed_total * sizeof(index_seed_t));
-    assert(index_seed != NULL);
+    assert(header.index_seed_offset + header.nb_seed_total * sizeof(index_seed_t) <= index_mapping_size);
 
-    xfer_file((uint8_t *)index_seed, sizeof(index_seed_t) * header.nb_seed_total, f, xfer_read);
-
-    for (unsigned int each_seed = 0; each_seed < header.nb_seed_total; each_seed++) {
-        if ((uintptr_t)index_seed[each_seed].next == UINTPTR_MAX) {
-            index_seed[each_seed].next = NULL;
-        } else {
-            index_seed[each_seed].next = (struct index_seed *)((uintptr_t)index_seed[each_seed].next + (uintptr_t)index_seed);
-        }
-    }
+    seed_directory = (seed_directory_block_t *)&index_mapping[header.seed_directory_offset];
+    seed_offsets = (uint32_t *)&index_mapping[header.seed_offsets_offset];
+    index_seed = (index_seed_t *)&index_mapping[header.index_seed_offset];
 
     nb_indexed_dpu = header.nb_dpus;
     printf("\tnb_dpu: %u\n"
            "\tsize_read: %u\n"
-           "\tsize_seed: %u\n",
-        nb_indexed_dpu, header.size_read, header.size_seed);
+           "\tsize_seed: %u\n"
+           "\tnb_seed_occupied: %u\n",
+        nb_indexed_dpu, header.size_read, header.size_seed, header.nb_seed_occupied);
 
-    fclose(f);
+    mram_map();
     printf("\ttime: %lf s\n", my_clock() - start_time);
 }
 
@@ -152,158 +284,394 @@ static int compute_nb_index_needed(int nb_seed) { return (nb_seed + MAX_SIZE_IDX
 static seed_counter_t *seed_counter;
 static pthread_barrier_t barrier;
 static uint64_t nb_seed_total;
+static uint32_t nb_seed_occupied;
 
-static void set_seed_counter(int thread_id)
+/* Each thread owns the seeds with a code in [thread_first_code[thread_id], thread_first_code[thread_id + 1]), so that no two
+ * threads update the same counter or write the same chunk */
+static int64_t thread_first_code[INDEX_THREAD + 1];
+
+/**
+ * @brief Seed found in the reference genome, handed to the thread owning its code.
+ */
+typedef struct {
+    uint32_t seed_code;
+    uint32_t seq_number;
+    uint64_t sequence_idx;
+} seed_entry_t;
+_Static_assert(NB_SEED - 1 <= UINT32_MAX, "seed_entry_t cannot hold the code of the seeds");
+
+/* The genome is read by rounds, each thread finding the seeds of the next INDEX_CHUNK_SIZE positions of the genome */
+#define INDEX_CHUNK_SIZE (1 << 16)
+
+/* Seeds found by each thread in its chunk of the current round, grouped by owner: the seeds found by "thread_id" for the
+ * thread "owner" start at seed_buckets[thread_id][seed_bucket_first[thread_id][owner]] and end before
+ * seed_buckets[thread_id][seed_bucket_first[thread_id][owner + 1]] */
+static seed_entry_t *seed_buckets[INDEX_THREAD];
+static uint32_t seed_bucket_first[INDEX_THREAD][INDEX_THREAD + 1];
+
+typedef void (*seed_fct_t)(genome_t *ref_genome, uint32_t seq_number, uint64_t sequence_idx, int64_t seed_code);
+
+static unsigned int get_seed_owner(int64_t seed_code)
 {
-    pthread_barrier_wait(&barrier);
-    for (int i = thread_id; i < NB_SEED; i += INDEX_THREAD) {
-        seed_counter[i].nb_seed = 0;
-        seed_counter[i].seed_code = i;
+    unsigned int first = 0, last = INDEX_THREAD;
+    while (last - first > 1) {
+        unsigned int middle = (first + last) / 2;
+        if (seed_code >= thread_first_code[middle]) {
+            first = middle;
+        } else {
+            last = middle;
+        }
     }
+    return first;
+}
 
-    static genome_t *ref_genome;
-    if (thread_id == 0)
-        ref_genome = genome_get();
-    pthread_barrier_wait(&barrier);
+/**
+ * @brief Find the seeds starting in [chunk_start, chunk_end) of the reference genome, in the order of the genome.
+ *
+ * @return The number of seeds found.
+ */
+static uint32_t find_chunk_seeds(genome_t *ref_genome, uint64_t chunk_start, uint64_t chunk_end, seed_entry_t *seeds,
+    uint8_t *owners, uint32_t *nb_seed_per_owner)
+{
+    const uint64_t size_neighbour_in_bytes = SIZE_NEIGHBOUR_IN_BYTES_OF(hashtable_header.size_read);
+    uint32_t nb_seed = 0;
+
+    for (uint32_t seq_number = 0; seq_number < ref_genome->nb_seq; seq_number++) {
+        uint64_t sequence_start_idx = ref_genome->pt_seq[seq_number];
+        if (ref_genome->len_seq[seq_number] < size_neighbour_in_bytes + SIZE_SEED) {
+            continue;
+        }
+        uint64_t nb_seed_in_sequence = ref_genome->len_seq[seq_number] - size_neighbour_in_bytes - SIZE_SEED + 1;
+        if (chunk_end <= sequence_start_idx || chunk_start >= sequence_start_idx + nb_seed_in_sequence) {
+            continue;
+        }
+        uint64_t first_seed_idx = chunk_start > sequence_start_idx ? chunk_start - sequence_start_idx : 0;
+        uint64_t last_seed_idx = MIN(chunk_end - sequence_start_idx, nb_seed_in_sequence);
+        int64_t seed_code = 0;
+        unsigned int nb_bases_in_seed = 0;
+
+        for (uint64_t base_idx = first_seed_idx; base_idx < last_seed_idx + SIZE_SEED - 1; base_idx++) {
+            int8_t base = genome_get_base(ref_genome, sequence_start_idx + base_idx);
+            if (base == GENOME_CODE_N) {
+                nb_bases_in_seed = 0;
+                continue;
+            }
+            seed_code = ((seed_code << 2) | base) & (NB_SEED - 1);
+            if (++nb_bases_in_seed >= SIZE_SEED) {
+                unsigned int owner = get_seed_owner(seed_code);
+                seeds[nb_seed] = (seed_entry_t) {
+                    .seed_code = seed_code, .seq_number = seq_number, .sequence_idx = base_idx - SIZE_SEED + 1
+                };
+                owners[nb_seed++] = owner;
+                nb_seed_per_owner[owner]++;
+            }
+        }
+    }
+    return nb_seed;
+}
+
+static void print_write_data_progress(genome_t *ref_genome, uint64_t nb_bases_done, double time)
+{
+    char time_str[FILENAME_MAX];
+    if (time < 60.0) {
+        sprintf(time_str, " - %us ", (unsigned int)time);
+    } else if (time < 3600.0) {
+        sprintf(time_str, " - %umin%us ", (unsigned int)time / 60, (unsigned int)time % 60);
+    } else {
+        sprintf(time_str, " - %uh%umin%us ", (unsigned int)time / 3600, (unsigned int)(time / 60) % 60,
+            (unsigned int)time % 60);
+    }
+    if (nb_bases_done >= ref_genome->nb_bases) {
+        printf("\r\t\t100.00%%#%u%s\n", ref_genome->nb_seq, time_str);
+        return;
+    }
+    uint32_t seq_number = 0;
+    while (seq_number + 1 < ref_genome->nb_seq && ref_genome->pt_seq[seq_number + 1] <= nb_bases_done) {
+        seq_number++;
+    }
+    printf("\r\t\t%2.2f%%#%u%s", ((float)nb_bases_done) * 100.0 / ref_genome->nb_bases, seq_number, time_str);
+    fflush(stdout);
+}
+
+/**
+ * @brief Call "fct" for each seed of the reference genome owned by the thread, in the order of the genome.
+ *
+ * Every thread of the pool must call it. At each round, each thread reads its own chunk of the genome, computing the code of
+ * the seeds incrementally, and groups the seeds found by owner. Each thread then handles its seeds from the chunks of every
+ * thread, in the order of the chunks, so that the work scales with the number of threads while the seeds of a code are
+ * still handled in the order of the genome.
+ */
+static void for_each_seed(int thread_id, seed_fct_t fct, bool show_progress)
+{
+    genome_t *ref_genome = genome_get();
+    const uint64_t round_size = (uint64_t)INDEX_CHUNK_SIZE * INDEX_THREAD;
+    const uint64_t nb_round = (ref_genome->nb_bases + round_size - 1) / round_size;
+    double start_time = my_clock(), last_print_time = start_time;
+
+    seed_entry_t *seeds = (seed_entry_t *)malloc(INDEX_CHUNK_SIZE * sizeof(seed_entry_t));
+    uint8_t *owners = (uint8_t *)malloc(INDEX_CHUNK_SIZE * sizeof(uint8_t));
+    seed_buckets[thread_id] = (seed_entry_t *)malloc(INDEX_CHUNK_SIZE * sizeof(seed_entry_t));
+    assert(seeds != NULL && owners != NULL && seed_buckets[thread_id] != NULL);
+
+    for (uint64_t each_round = 0; each_round < nb_round; each_round++) {
+        uint64_t chunk_start = (each_round * INDEX_THREAD + thread_id) * INDEX_CHUNK_SIZE;
+        uint32_t nb_seed_per_owner[INDEX_THREAD] = { 0 };
+        uint32_t nb_seed
+            = find_chunk_seeds(ref_genome, chunk_start, chunk_start + INDEX_CHUNK_SIZE, seeds, owners, nb_seed_per_owner);
+
+        uint32_t *bucket_first = seed_bucket_first[thread_id];
+        uint32_t bucket_cursor[INDEX_THREAD];
+        bucket_first[0] = 0;
+        for (unsigned int each_owner = 0; each_owner < INDEX_THREAD; each_owner++) {
+            bucket_cursor[each_owner] = bucket_first[each_owner];
+            bucket_first[each_owner + 1] = bucket_first[each_owner] + nb_seed_per_owner[each_owner];
+        }
+        for (uint32_t each_seed = 0; each_seed < nb_seed; each_seed++) {
+            seed_buckets[thread_id][bucket_cursor[owners[each_seed]]++] = seeds[each_seed];
+        }
+        pthread_barrier_wait(&barrier);
+
+        for (unsigned int each_thread = 0; each_thread < INDEX_THREAD; each_thread++) {
+            seed_entry_t *bucket = seed_buckets[each_thread];
+            for (uint32_t each_seed = seed_bucket_first[each_thread][thread_id];
+                 each_seed < seed_bucket_first[each_thread][thread_id + 1]; each_seed++) {
+                fct(ref_genome, bucket[each_seed].seq_number, bucket[each_seed].sequence_idx, bucket[each_seed].seed_code);
+            }
+        }
+        if (show_progress && my_clock() - last_print_time >= 1.0) {
+            last_print_time = my_clock();
+            print_write_data_progress(ref_genome, (each_round + 1) * round_size, last_print_time - start_time);
+        }
+        pthread_barrier_wait(&barrier);
+    }
+    if (show_progress) {
+        print_write_data_progress(ref_genome, ref_genome->nb_bases, my_clock() - start_time);
+    }
 
-    for (uint32_t i = 0; i < ref_genome->nb_seq; i++) {
-        uint64_t sequence_start_idx = ref_genome->pt_seq[i];
-        for (uint64_t sequence_idx = thread_id; sequence_idx < ref_genome->len_seq[i] - SIZE_NEIGHBOUR_IN_BYTES - SIZE_SEED + 1;
-             sequence_idx += INDEX_THREAD) {
-            int seed_code = code_seed(&ref_genome->data[sequence_start_idx + sequence_idx]);
-            if (seed_code >= 0) {
-                __sync_fetch_and_add(&seed_counter[seed_code].nb_seed, 1);
+    free(seeds);
+    free(owners);
+    free(seed_buckets[thread_id]);
+}
+
+/**
+ * @brief Split the seeds between the threads, with the same number of codes for each thread.
+ */
+static void set_thread_first_code(unsigned int nb_thread)
+{
+    int64_t nb_block_per_thread = (NB_SEED_DIRECTORY_BLOCK + nb_thread - 1) / nb_thread;
+    for (unsigned int each_thread = 0; each_thread <= INDEX_THREAD; each_thread++) {
+        int64_t first_code = each_thread * nb_block_per_thread * SEED_DIRECTORY_BLOCK_SIZE;
+        thread_first_code[each_thread] = first_code < NB_SEED ? first_code : NB_SEED;
+    }
+}
+
+/**
+ * @brief Split the seeds between the threads, with the same number of neighbours for each thread.
+ */
+static void set_thread_first_code_by_workload(unsigned int nb_thread)
+{
+    uint64_t nb_neighbour_total = 0;
+    for (uint32_t each_rank = 0; each_rank < nb_seed_occupied; each_rank++) {
+        nb_neighbour_total += seed_counter[each_rank].nb_seed;
+    }
+
+    unsigned int thread = 0;
+    uint64_t nb_neighbour = 0;
+    uint32_t seed_rank = 0;
+    thread_first_code[0] = 0;
+    for (int64_t each_block = 0; each_block < NB_SEED_DIRECTORY_BLOCK; each_block++) {
+        for (unsigned int each_word = 0; each_word < SEED_DIRECTORY_BLOCK_SIZE / 64; each_word++) {
+            for (uint64_t occupied = seed_directory[each_block].occupied[each_word]; occupied != 0; occupied &= occupied - 1) {
+                nb_neighbour += seed_counter[seed_rank++].nb_seed;
+                while (thread + 1 < nb_thread && nb_neighbour * nb_thread >= nb_neighbour_total * (thread + 1)) {
+                    thread_first_code[++thread]
+                        = each_block * SEED_DIRECTORY_BLOCK_SIZE + each_word * 64 + __builtin_ctzll(occupied) + 1;
+                }
             }
         }
     }
+    while (thread < INDEX_THREAD) {
+        thread_first_code[++thread] = NB_SEED;
+    }
+}
+
+static void set_seed_directory_fct(__attribute__((unused)) genome_t *ref_genome, __attribute__((unused)) uint32_t seq_number,
+    __attribute__((unused)) uint64_t sequence_idx, int64_t seed_code)
+{
+    unsigned int seed_idx = seed_code % SEED_DIRECTORY_BLOCK_SIZE;
+    seed_directory_get_block(seed_code)->occupied[seed_idx / 64] |= 1ULL << (seed_idx % 64);
+}
+
+static void set_seed_directory(int thread_id)
+{
+    pthread_barrier_wait(&barrier);
+    for_each_seed(thread_id, set_seed_directory_fct, false);
+    pthread_barrier_wait(&barrier);
+}
+
+static void set_seed_counter_fct(__attribute__((unused)) genome_t *ref_genome, __attribute__((unused)) uint32_t seq_number,
+    __attribute__((unused)) uint64_t sequence_idx, int64_t seed_code)
+{
+    uint32_t seed_rank;
+    assert(seed_directory_get_rank(seed_code, &seed_rank));
+    seed_counter[seed_rank].nb_seed++;
+}
+
+static void set_seed_counter(int thread_id)
+{
+    pthread_barrier_wait(&barrier);
+    for (uint32_t i = thread_id; i < nb_seed_occupied; i += INDEX_THREAD) {
+        seed_counter[i].nb_seed = 0;
+        seed_counter[i].seed_rank = i;
+    }
+    pthread_barrier_wait(&barrier);
+
+    for_each_seed(thread_id, set_seed_counter_fct, false);
     pthread_barrier_wait(&barrier);
 }
 
 static void init_index_seed(int thread_id)
 {
-    static uint64_t seed_offset = NB_SEED;
-
     pthread_barrier_wait(&barrier);
-    for (int i = thread_id; i < NB_SEED; i += INDEX_THREAD) {
-        if (seed_counter[i].nb_seed == 0) {
-            index_seed[i].nb_nbr = 0;
-            index_seed[i].next = NULL;
+    for (uint32_t i = thread_id; i < nb_seed_occupied; i += INDEX_THREAD) {
+        int nb_index_needed = seed_offsets[i + 1] - seed_offsets[i];
+        if (nb_index_needed == 0) {
             continue;
         }
 
-        int nb_index_needed = compute_nb_index_needed(seed_counter[i].nb_seed);
+        index_seed_t *seeds = &index_seed[seed_offsets[i]];
         int nb_neighbour_per_index = (seed_counter[i].nb_seed + nb_index_needed - 1) / nb_index_needed;
-        index_seed[i].nb_nbr = seed_counter[i].nb_seed - ((nb_index_needed - 1) * nb_neighbour_per_index);
-        index_seed[i].next = NULL;
+        seeds[0].nb_nbr = seed_counter[i].nb_seed - ((nb_index_needed - 1) * nb_neighbour_per_index);
         for (int j = 1; j < nb_index_needed; j++) {
-            index_seed_t *seed = &index_seed[__sync_fetch_and_add(&seed_offset, 1)];
-            seed->nb_nbr = nb_neighbour_per_index;
-            seed->next = index_seed[i].next;
-            index_seed[i].next = seed;
+            seeds[j].nb_nbr = nb_neighbour_per_index;
         }
     }
     pthread_barrier_wait(&barrier);
 }
 
-static void adjust_index_seed_next(int thread_id)
+/**
+ * @brief Min-heap of the DPUs, ordered by the largest of their workload and size relative to the average of each.
+ */
+typedef struct {
+    distribute_index_t **dpus;
+    unsigned int nb_dpu;
+    double workload_per_dpu;
+    double size_per_dpu;
+} distribute_index_heap_t;
+
+static double distribute_index_load(distribute_index_heap_t *heap, distribute_index_t *dpu)
 {
-    pthread_barrier_wait(&barrier);
-    for (unsigned int i = thread_id; i < nb_seed_total; i += INDEX_THREAD) {
-        if (index_seed[i].next == NULL) {
-            index_seed[i].next = (index_seed_t *)(UINTPTR_MAX);
-        } else {
-            index_seed[i].next = (index_seed_t *)((uintptr_t)index_seed[i].next - (uintptr_t)index_seed);
+    double workload_load = dpu->workload / heap->workload_per_dpu;
+    double size_load = dpu->size / heap->size_per_dpu;
+    return workload_load > size_load ? workload_load : size_load;
+}
+
+static bool distribute_index_lower(distribute_index_heap_t *heap, distribute_index_t *a, distribute_index_t *b)
+{
+    double load_a = distribute_index_load(heap, a);
+    double load_b = distribute_index_load(heap, b);
+    return load_a < load_b || (load_a == load_b && a->dpu_id < b->dpu_id);
+}
+
+/**
+ * @brief Put back the first DPU of the heap at its place after its load has increased.
+ */
+static void distribute_index_sift_down(distribute_index_heap_t *heap)
+{
+    unsigned int parent = 0;
+    while (true) {
+        unsigned int lowest = parent;
+        unsigned int child = 2 * parent + 1;
+        if (child < heap->nb_dpu && distribute_index_lower(heap, heap->dpus[child], heap->dpus[lowest])) {
+            lowest = child;
+        }
+        if (child + 1 < heap->nb_dpu && distribute_index_lower(heap, heap->dpus[child + 1], heap->dpus[lowest])) {
+            lowest = child + 1;
         }
+        if (lowest == parent) {
+            return;
+        }
+        distribute_index_t *dpu = heap->dpus[parent];
+        heap->dpus[parent] = heap->dpus[lowest];
+        heap->dpus[lowest] = dpu;
+        parent = lowest;
     }
-    pthread_barrier_wait(&barrier);
 }
-static void write_data(int thread_id)
+
+static void distribute_index_print_stats(distribute_index_t *table, unsigned int nb_dpu)
 {
-    static genome_t *ref_genome;
-    static volatile uint32_t seq_number_shared[INDEX_THREAD_SLAVE] = { 0 };
-    static volatile uint64_t sequence_idx_shared[INDEX_THREAD_SLAVE] = { 0 };
-    coords_and_nbr_t buffer;
-    if (thread_id == 0)
-        ref_genome = genome_get();
-    pthread_barrier_wait(&barrier);
-    if (thread_id == INDEX_THREAD_SLAVE) {
-        double start_time = my_clock();
-        while (true) {
-            uint32_t slowest_thread_seq = UINT_MAX;
-            uint64_t slowest_thread_sequence = ULONG_MAX;
-            for (unsigned int each_thread = 0; each_thread < INDEX_THREAD_SLAVE; each_thread++) {
-                uint32_t curr_seq = seq_number_shared[each_thread];
-                uint32_t sequence_curr = sequence_idx_shared[each_thread];
-                if (curr_seq < slowest_thread_seq) {
-                    slowest_thread_seq = curr_seq;
-                    slowest_thread_sequence = sequence_curr;
-                } else if (curr_seq == slowest_thread_seq && sequence_curr < slowest_thread_sequence) {
-                    slowest_thread_sequence = sequence_curr;
-                }
-            }
-            double time = my_clock() - start_time;
-            char time_str[FILENAME_MAX];
-            if (time < 60.0) {
-                sprintf(time_str, " - %us ", (unsigned int)time);
-            } else if (time < 3600.0) {
-                sprintf(time_str, " - %umin%us ", (unsigned int)time / 60, (unsigned int)time % 60);
-            } else {
-                sprintf(time_str, " - %uh%umin%us ", (unsigned int)time / 3600, (unsigned int)(time / 60) % 60,
-                    (unsigned int)time % 60);
-            }
-            if (slowest_thread_seq == ref_genome->nb_seq) {
-                printf("\r\t\t100.00%%#%u%s\n", ref_genome->nb_seq, time_str);
-                break;
-            }
-            printf("\r\t\t%2.2f%%#%u%s", ((float)slowest_thread_sequence) * 100.0 / ref_genome->len_seq[slowest_thread_seq],
-                slowest_thread_seq, time_str);
-            fflush(stdout);
-            usleep(1000000);
-        }
-    } else {
-        for (uint32_t seq_number = 0; seq_number < ref_genome->nb_seq; seq_number++, seq_number_shared[thread_id] = seq_number) {
-            uint64_t sequence_start_idx = ref_genome->pt_seq[seq_number];
-            for (uint64_t sequence_idx = thread_id;
-                 sequence_idx < ref_genome->len_seq[seq_number] - SIZE_NEIGHBOUR_IN_BYTES - SIZE_SEED + 1;
-                 sequence_idx += INDEX_THREAD_SLAVE, sequence_idx_shared[thread_id] = sequence_idx) {
-                index_seed_t *seed;
-                int align_idx;
-                int seed_code = code_seed(&ref_genome->data[sequence_start_idx + sequence_idx]);
-
-                if (seed_code < 0) {
-                    continue;
-                }
+    uint64_t min_workload = UINT64_MAX, max_workload = 0, total_workload = 0;
+    uint32_t min_size = UINT32_MAX, max_size = 0;
+    uint64_t total_size = 0;
+    for (unsigned int each_dpu = 0; each_dpu < nb_dpu; each_dpu++) {
+        min_workload = MIN(min_workload, table[each_dpu].workload);
+        max_workload = MAX(max_workload, table[each_dpu].workload);
+        total_workload += table[each_dpu].workload;
+        min_size = MIN(min_size, table[each_dpu].size);
+        max_size = MAX(max_size, table[each_dpu].size);
+        total_size += table[each_dpu].size;
+    }
+    printf("\t\tworkload: min %lu, max %lu, max/average %.3f\n"
+           "\t\tsize: min %u, max %u, max/average %.3f\n",
+        min_workload, max_workload, max_workload * (double)nb_dpu / total_workload, min_size, max_size,
+        max_size * (double)nb_dpu / total_size);
+}
+
+static void write_data_fct(genome_t *ref_genome, uint32_t seq_number, uint64_t sequence_idx, int64_t seed_code)
+{
+    const unsigned int size_neighbour_in_bytes = SIZE_NEIGHBOUR_IN_BYTES_OF(hashtable_header.size_read);
+    /* Zeroed so that the padding of the neighbour does not depend on the stack of the thread */
+    uint64_t buffer_data[COORDS_AND_NBR_SIZE(SIZE_READ_MAX) / sizeof(uint64_t)] = { 0 };
+    coords_and_nbr_t *buffer = (coords_and_nbr_t *)buffer_data;
+    int8_t neighbour[SIZE_READ_MAX];
+    index_seed_t *seed;
+    int align_idx;
+    uint32_t seed_rank;
+
+    assert(seed_directory_get_rank(seed_code, &seed_rank));
+    seed = &index_seed[seed_offsets[seed_rank]];
+
+    int total_nb_neighbour = 0;
+    int32_t nb_seed = seed_counter[seed_rank].nb_seed++;
+    while (nb_seed >= (int)seed->nb_nbr + total_nb_neighbour) {
+        total_nb_neighbour += seed->nb_nbr;
+        seed++;
+    }
+    align_idx = seed->offset + nb_seed - total_nb_neighbour;
+    if (!vmi_in_group(seed->num_dpu)) {
+        return;
+    }
 
-                seed = &index_seed[seed_code];
+    buffer->coord.seq_nr = seq_number;
+    buffer->coord.seed_nr = sequence_idx;
+    genome_get_bases(ref_genome, ref_genome->pt_seq[seq_number] + sequence_idx + SIZE_SEED, size_neighbour_in_bytes * 4, neighbour);
+    code_neighbour(neighbour, (int8_t *)buffer->nbr, size_neighbour_in_bytes);
+    write_vmi(seed->num_dpu, align_idx, buffer);
+}
 
-                int total_nb_neighbour = 0;
-                int32_t nb_seed = __sync_fetch_and_add(&seed_counter[seed_code].nb_seed, 1);
-                while (seed != NULL) {
-                    if (nb_seed < (int)seed->nb_nbr + total_nb_neighbour)
-                        break;
-                    total_nb_neighbour += seed->nb_nbr;
-                    seed = seed->next;
-                }
-                align_idx = seed->offset + nb_seed - total_nb_neighbour;
+/* Set by the master before the last call of write_data, when every group of DPUs has been written */
+static bool write_data_done;
 
-                buffer.coord.seq_nr = seq_number;
-                buffer.coord.seed_nr = sequence_idx;
-                code_neighbour(&ref_genome->data[sequence_start_idx + sequence_idx + SIZE_SEED], (int8_t *)&buffer.nbr);
-                write_vmi(seed->num_dpu, align_idx, &buffer);
-            }
-        }
+static bool write_data(int thread_id)
+{
+    pthread_barrier_wait(&barrier);
+    if (write_data_done) {
+        return false;
     }
+    for_each_seed(thread_id, write_data_fct, thread_id == INDEX_THREAD_SLAVE);
     pthread_barrier_wait(&barrier);
+    return true;
 }
 
 static void *index_create_slave_fct(void *args)
 {
     uint32_t thread_id = (uint32_t)(uintptr_t)args;
 
+    set_seed_directory(thread_id);
     set_seed_counter(thread_id);
     init_index_seed(thread_id);
-    write_data(thread_id);
-    adjust_index_seed_next(thread_id);
+    while (write_data(thread_id))
+        ;
 
     return NULL;
 }
@@ -329,16 +697,44 @@ void index_create()
     pthread_t thread_id[INDEX_THREAD_SLAVE];
     distribute_index_t *distribute_index_table;
 
+    hashtable_header.size_read = get_size_read();
+    printf("\tsize_read: %u\n", hashtable_header.size_read);
+
     assert(pthread_barrier_init(&barrier, NULL, INDEX_THREAD) == 0);
     for (unsigned int each_thread = 0; each_thread < INDEX_THREAD_SLAVE; each_thread++) {
         assert(pthread_create(&thread_id[each_thread], NULL, index_create_slave_fct, (void *)(uintptr_t)each_thread) == 0);
     }
 
+    {
+        double init_seed_directory_time = my_clock();
+        printf("\tInitialize the seed directory\n");
+        seed_directory = (seed_directory_block_t *)calloc(NB_SEED_DIRECTORY_BLOCK, sizeof(seed_directory_block_t));
+        assert(seed_directory != NULL);
+        set_thread_first_code(INDEX_THREAD);
+        set_seed_directory(INDEX_THREAD_SLAVE);
+
+        uint64_t rank = 0;
+        for (int64_t each_block = 0; each_block < NB_SEED_DIRECTORY_BLOCK; each_block++) {
+            seed_directory[each_block].rank = rank;
+            for (unsigned int each_word = 0; each_word < SEED_DIRECTORY_BLOCK_SIZE / 64; each_word++) {
+                rank += __builtin_popcountll(seed_directory[each_block].occupied[each_word]);
+            }
+        }
+        assert(rank < UINT32_MAX);
+        nb_seed_occupied = rank;
+
+        printf("\t\tnb_seed_occupied=%u (%.2f%%)\n"
+               "\t\ttime: %lf s\n",
+            nb_seed_occupied, nb_seed_occupied * 100.0 / NB_SEED, my_clock() - init_seed_directory_time);
+    }
+
     {
         double init_seed_counter_time = my_clock();
         printf("\tInitialize the seed_counter table\n");
-        seed_counter = (seed_counter_t *)malloc(NB_SEED * sizeof(seed_counter_t));
+        seed_counter = (seed_counter_t *)malloc(nb_seed_occupied * sizeof(seed_counter_t));
+        assert(seed_counter != NULL);
         set_seed_counter(INDEX_THREAD_SLAVE);
+        set_thread_first_code_by_workload(INDEX_THREAD);
 
         printf("\t\ttime: %lf s\n", my_clock() - init_seed_counter_time);
     }
@@ -346,10 +742,15 @@ void index_create()
     {
         double alloc_index_seed_time = my_clock();
         printf("\tAllocating the index table\n");
-        nb_seed_total = NB_SEED;
-        for (int i = 0; i < NB_SEED; i++) {
+        seed_offsets = (uint32_t *)malloc((nb_seed_occupied + 1) * sizeof(uint32_t));
+        assert(seed_offsets != NULL);
+        nb_seed_total = 0;
+        for (uint32_t i = 0; i < nb_seed_occupied; i++) {
+            seed_offsets[i] = nb_seed_total;
             nb_seed_total += compute_nb_index_needed(seed_counter[i].nb_seed);
         }
+        assert(nb_seed_total <= UINT32_MAX);
+        seed_offsets[nb_seed_occupied] = nb_seed_total;
         index_seed = (index_seed_t *)malloc(sizeof(index_seed_t) * nb_seed_total);
         assert(index_seed != NULL);
         printf("\t\tnb_seed_total=%lu\n"
@@ -359,7 +760,7 @@ void index_create()
 
     {
         double create_init_link_all_seed_time = my_clock();
-        printf("\tCreate, initialize and link together all the seeds\n");
+        printf("\tCreate and initialize all the seeds\n");
         init_index_seed(INDEX_THREAD_SLAVE);
         printf("\t\ttime: %lf s\n", my_clock() - create_init_link_all_seed_time);
     }
@@ -367,7 +768,7 @@ void index_create()
     {
         double sort_time = my_clock();
         printf("\tSort seed counter\n");
-        qsort(seed_counter, NB_SEED, sizeof(seed_counter_t), cmp_seed_counter);
+        qsort(seed_counter, nb_seed_occupied, sizeof(seed_counter_t), cmp_seed_counter);
         printf("\t\ttime: %lf s\n", my_clock() - sort_time);
     }
 
@@ -377,46 +778,39 @@ void index_create()
 
         distribute_index_table = (distribute_index_t *)calloc(nb_dpu, sizeof(distribute_index_t));
         assert(distribute_index_table != NULL);
-        struct distribute_index_list head = TAILQ_HEAD_INITIALIZER(head);
+        distribute_index_heap_t heap = { .nb_dpu = nb_dpu, .workload_per_dpu = 0.0, .size_per_dpu = 0.0 };
+        heap.dpus = (distribute_index_t **)malloc(nb_dpu * sizeof(distribute_index_t *));
+        assert(heap.dpus != NULL);
 
         for (unsigned int i = 0; i < nb_dpu; i++) {
             distribute_index_table[i].dpu_id = i;
-            TAILQ_INSERT_TAIL(&head, &distribute_index_table[i], entries);
+            heap.dpus[i] = &distribute_index_table[i];
+        }
+        for (uint32_t i = 0; i < nb_seed_occupied; i++) {
+            heap.workload_per_dpu += (double)seed_counter[i].nb_seed * seed_counter[i].nb_seed;
+            heap.size_per_dpu += seed_counter[i].nb_seed;
         }
+        heap.workload_per_dpu /= nb_dpu;
+        heap.size_per_dpu /= nb_dpu;
 
-        for (int i = 0; i < NB_SEED; i++) {
-            int seed_code = seed_counter[i].seed_code;
+        for (uint32_t i = 0; i < nb_seed_occupied; i++) {
+            uint32_t seed_rank = seed_counter[i].seed_rank;
             int nb_seed_counted = seed_counter[i].nb_seed;
-            index_seed_t *seed = &index_seed[seed_code];
-            if (seed->nb_nbr == 0 && seed->next == NULL) {
-                continue;
-            }
+            index_seed_t *seed = &index_seed[seed_offsets[seed_rank]];
+            index_seed_t *last_seed = &index_seed[seed_offsets[seed_rank + 1]];
 
-            while (seed != NULL) {
-                distribute_index_t *dpu = TAILQ_LAST(&head, distribute_index_list);
-                TAILQ_REMOVE(&head, dpu, entries);
+            for (; seed != last_seed; seed++) {
+                distribute_index_t *dpu = heap.dpus[0];
                 seed->offset = dpu->size;
                 seed->num_dpu = dpu->dpu_id;
                 dpu->size += seed->nb_nbr;
                 dpu->workload += (uint64_t)seed->nb_nbr * (uint64_t)nb_seed_counted;
-                seed = seed->next;
-
-                distribute_index_t *dpu_cmp;
-                bool dpu_inserted = false;
-                TAILQ_FOREACH(dpu_cmp, &head, entries)
-                {
-                    if (dpu->workload >= dpu_cmp->workload) {
-                        TAILQ_INSERT_BEFORE(dpu_cmp, dpu, entries);
-                        dpu_inserted = true;
-                        break;
-                    }
-                }
-                if (!dpu_inserted) {
-                    TAILQ_INSERT_HEAD(&head, dpu, entries);
-                }
+                distribute_index_sift_down(&heap);
             }
         }
+        free(heap.dpus);
 
+        distribute_index_print_stats(distribute_index_table, nb_dpu);
         printf("\t\ttime: %lf s\n", my_clock() - distribute_index_time);
     }
 
@@ -425,9 +819,21 @@ void index_create()
         double write_in_memories_time = my_clock();
         printf("\tWriting data in DPUs memories\n");
 
-        memset(seed_counter, 0, sizeof(seed_counter_t) * NB_SEED);
-
         init_vmis(nb_dpu, distribute_index_table);
+        for (unsigned int first_dpu = 0; first_dpu < nb_dpu;) {
+            unsigned int last_dpu = alloc_vmis_group(first_dpu, get_memory_budget());
+            if (first_dpu != 0 || last_dpu != nb_dpu) {
+                printf("\t\tDPUs %u to %u\n", first_dpu, last_dpu - 1);
+            }
+
+            do {
+                memset(seed_counter, 0, sizeof(seed_counter_t) * nb_seed_occupied);
+                write_data(INDEX_THREAD_SLAVE);
+            } while (flush_vmis_window());
+            write_vmis_group();
+            first_dpu = last_dpu;
+        }
+        write_data_done = true;
         write_data(INDEX_THREAD_SLAVE);
         free_vmis(nb_dpu);
 
@@ -443,13 +849,21 @@ void index_create()
         CHECK_FILE(f, get_index_filename());
 
         hashtable_header.nb_seed_total = nb_seed_total;
+        hashtable_header.nb_seed_occupied = nb_seed_occupied;
         hashtable_header.nb_dpus = nb_dpu;
         fwrite(&hashtable_header, sizeof(hashtable_header_t), 1, f);
 
-        adjust_index_seed_next(INDEX_THREAD_SLAVE);
-
+        hashtable_header.seed_directory_offset = xfer_file_align(f);
+        xfer_file((uint8_t *)seed_directory, sizeof(seed_directory_block_t) * NB_SEED_DIRECTORY_BLOCK, f, xfer_write);
+        hashtable_header.seed_offsets_offset = xfer_file_align(f);
+        xfer_file((uint8_t *)seed_offsets, sizeof(uint32_t) * (nb_seed_occupied + 1), f, xfer_write);
+        hashtable_header.index_seed_offset = xfer_file_align(f);
         xfer_file((uint8_t *)index_seed, sizeof(index_seed_t) * nb_seed_total, f, xfer_write);
 
+        /* The offsets of the sections are only known once they have been written */
+        rewind(f);
+        fwrite(&hashtable_header, sizeof(hashtable_header_t), 1, f);
+
         fclose(f);
         printf("\t\ttime: %lf s\n", my_clock() - start_time);
     }
@@ -462,7 +876,17 @@ void index_create()
     printf("\ttime: %lf s\n", my_clock() - start_time);
 }
 
-void index_free() { free(index_seed); }
+void index_free()
+{
+    mram_unmap();
+    if (index_mapping != NULL) {
+        munmap(index_mapping, index_mapping_size);
+    } else {
+        free(seed_directory);
+        free(seed_offsets);
+        free(index_seed);
+    }
+}
 
 char *get_index_folder()
 {
@@ -7,10 +7,13 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -22,129 +25,450 @@
 
 #include <dpu.h>
 
-#define MRAM_FORMAT "mram_%04u.bin"
-#define MRAM_SIZE_AVAILABLE (MRAM_SIZE - MAX_DPU_REQUEST * sizeof(dpu_request_t) - MAX_DPU_RESULTS * sizeof(dpu_result_out_t))
+#define MRAM_CONTAINER_FILE "mram.bin"
+#define MRAM_CONTAINER_MAGIC (0x4d52414d)
+#define MRAM_CONTAINER_VERSION (1)
+#define MRAM_SIZE_AVAILABLE(size_read) (MRAM_SIZE - MRAM_SIZE_RESERVED(size_read))
+_Static_assert(MRAM_SIZE_RESERVED(SIZE_READ_MAX) < MRAM_SIZE, "Too many request and/or result compare to MRAM_SIZE");
+
+/**
+ * @brief Header of the file containing the MRAM images of every DPU.
+ *
+ * It is followed by the directory of the images (one mram_container_entry_t per DPU), then by the images themselves, each
+ * one starting on an aligned section of the file. The file is padded after the last image so that "max_size" bytes can be
+ * read from the beginning of any image: the transfers of a rank are done with the size of its biggest image.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nb_dpu;
+    uint32_t max_size;
+} mram_container_header_t;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+} mram_container_entry_t;
+
 typedef struct {
     uint32_t size;
+    uint64_t offset;
     uint8_t *buffer;
 } vmi_t;
-static const size_t mram_size = MRAM_SIZE_AVAILABLE;
 static vmi_t *vmis = NULL;
-_Static_assert(MRAM_SIZE_AVAILABLE > 0, "Too many request and/or result compare to MRAM_SIZE");
+static unsigned int nb_vmis;
+static size_t coords_and_nbr_size;
+static int mram_container_fd = -1;
+
+static uint8_t *mram_container = NULL;
+static size_t mram_container_size;
+static mram_container_entry_t *mram_container_directory;
 
-static char *make_mram_file_name(unsigned int dpu_id)
+/* When mapping, the MRAM of each DPU holds the images of mram_pack consecutive virtual DPUs of the index, each one in its
+ * own slot of mram_slot_size bytes */
+static unsigned int mram_pack;
+static uint32_t mram_slot_size;
+/* Number of banks of the index in the MRAM: with two banks, the next run is loaded while the DPUs work on the current one */
+static unsigned int mram_nb_bank;
+
+/* The prefetcher reads the pages of the images of the DPUs [mram_prefetch_first_dpu, mram_prefetch_last_dpu) */
+static pthread_t mram_prefetch_thread;
+static sem_t mram_prefetch_start_sem, mram_prefetch_done_sem;
+static unsigned int mram_prefetch_first_dpu, mram_prefetch_last_dpu;
+static double mram_prefetch_time;
+static bool mram_prefetch_stop, mram_prefetch_pending;
+/* Keeps the reads of the prefetched pages from being optimized out */
+static volatile uint8_t mram_prefetch_sink;
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) < (b) ? (b) : (a))
+
+/**
+ * @brief Bring the pages of the images to prefetch in memory, by starting the read-ahead then reading one byte per page,
+ * so that they are resident before the transfers of the next run.
+ */
+static void *mram_prefetch_fct(__attribute__((unused)) void *arg)
+{
+    while (true) {
+        sem_wait(&mram_prefetch_start_sem);
+        if (mram_prefetch_stop) {
+            return NULL;
+        }
+
+        double start_time = my_clock();
+        uint8_t sum = 0;
+        for (unsigned int each_dpu = mram_prefetch_first_dpu; each_dpu < mram_prefetch_last_dpu; each_dpu++) {
+            uint8_t *image = &mram_container[mram_container_directory[each_dpu].offset];
+            size_t size = mram_container_directory[each_dpu].size;
+            madvise(image, size, MADV_WILLNEED);
+            for (size_t offset = 0; offset < size; offset += FILE_SECTION_ALIGNMENT) {
+                sum += image[offset];
+            }
+        }
+        mram_prefetch_sink = sum;
+        mram_prefetch_time = my_clock() - start_time;
+
+        sem_post(&mram_prefetch_done_sem);
+    }
+}
+
+static char *make_mram_container_name()
 {
     char *file_name;
     char *index_folder = get_index_folder();
-    assert(asprintf(&file_name, "%s" MRAM_FORMAT, index_folder, dpu_id) > 0);
+    assert(asprintf(&file_name, "%s" MRAM_CONTAINER_FILE, index_folder) > 0);
     assert(file_name != NULL);
     free(index_folder);
     return file_name;
 }
 
-size_t mram_load(uint8_t **mram, unsigned int dpu_id)
+void mram_map()
 {
-    char *file_name = make_mram_file_name(dpu_id);
+    char *file_name = make_mram_container_name();
     FILE *f = fopen(file_name, "rb");
     CHECK_FILE(f, file_name);
     free(file_name);
 
-    fseek(f, 0, SEEK_END);
-    size_t size = ftell(f);
-    rewind(f);
+    mram_container = map_file(f, &mram_container_size);
+    fclose(f);
 
-    assert(mram_size >= size);
-    *mram = malloc(mram_size);
-    assert(*mram != NULL);
+    mram_container_header_t header;
+    assert(mram_container_size >= sizeof(header));
+    memcpy(&header, mram_container, sizeof(header));
+    assert(header.magic == MRAM_CONTAINER_MAGIC && header.version == MRAM_CONTAINER_VERSION
+        && "Could not load MRAM images generated with a different version of UPVC.");
+    assert(header.nb_dpu == index_get_nb_dpu());
+    assert(header.max_size <= MRAM_SIZE_AVAILABLE(index_get_size_read()));
 
-    size_t read_size = fread(*mram, sizeof(uint8_t), size, f);
-    assert(read_size == size);
+    mram_container_directory = (mram_container_entry_t *)&mram_container[sizeof(header)];
+    for (unsigned int each_dpu = 0; each_dpu < header.nb_dpu; each_dpu++) {
+        assert(mram_container_directory[each_dpu].offset + header.max_size <= mram_container_size);
+    }
 
-    fclose(f);
-    return read_size;
+    mram_slot_size = header.max_size;
+    mram_pack = get_nb_virtual_dpu_per_dpu();
+    unsigned int max_pack = mram_slot_size == 0 ? header.nb_dpu : MRAM_SIZE_AVAILABLE(index_get_size_read()) / mram_slot_size;
+    if (mram_pack > max_pack) {
+        WARNING("only %u virtual DPUs fit in the MRAM of a DPU", max_pack);
+        mram_pack = max_pack;
+    }
+    if (mram_pack > header.nb_dpu) {
+        mram_pack = header.nb_dpu;
+    }
+    if (mram_pack > 1) {
+        printf("\tpacking %u virtual DPUs per DPU (%u DPUs)\n", mram_pack, mram_get_nb_dpu());
+    }
+    mram_nb_bank = 1;
+    if ((unsigned long long)MRAM_NB_BANK_MAX * mram_get_bank_size() <= MRAM_SIZE_AVAILABLE(index_get_size_read())) {
+        mram_nb_bank = MRAM_NB_BANK_MAX;
+    }
+    printf("\tMRAM banks: %u\n", mram_nb_bank);
+
+    mram_prefetch_stop = false;
+    mram_prefetch_pending = false;
+    assert(sem_init(&mram_prefetch_start_sem, 0, 0) == 0);
+    assert(sem_init(&mram_prefetch_done_sem, 0, 0) == 0);
+    assert(pthread_create(&mram_prefetch_thread, NULL, mram_prefetch_fct, NULL) == 0);
+}
+
+void mram_unmap()
+{
+    if (mram_container != NULL) {
+        double hidden_time;
+        mram_prefetch_wait(&hidden_time);
+        mram_prefetch_stop = true;
+        sem_post(&mram_prefetch_start_sem);
+        assert(pthread_join(mram_prefetch_thread, NULL) == 0);
+        assert(sem_destroy(&mram_prefetch_start_sem) == 0);
+        assert(sem_destroy(&mram_prefetch_done_sem) == 0);
+
+        munmap(mram_container, mram_container_size);
+        mram_container = NULL;
+    }
+}
+
+void mram_prefetch(unsigned int first_dpu, unsigned int nb_dpu)
+{
+    assert(!mram_prefetch_pending);
+    mram_prefetch_first_dpu = first_dpu * mram_pack;
+    mram_prefetch_last_dpu = MIN((first_dpu + nb_dpu) * mram_pack, index_get_nb_dpu());
+    mram_prefetch_pending = true;
+    sem_post(&mram_prefetch_start_sem);
+}
+
+bool mram_prefetch_wait(double *hidden_time)
+{
+    if (!mram_prefetch_pending) {
+        return false;
+    }
+    double start_time = my_clock();
+    sem_wait(&mram_prefetch_done_sem);
+    double wait_time = my_clock() - start_time;
+    mram_prefetch_pending = false;
+    *hidden_time = MAX(mram_prefetch_time - wait_time, 0.0);
+    return true;
+}
+
+unsigned int mram_get_nb_dpu() { return (index_get_nb_dpu() + mram_pack - 1) / mram_pack; }
+
+unsigned int mram_get_nb_slot() { return mram_pack; }
+
+uint32_t mram_get_slot_size() { return mram_slot_size; }
+
+unsigned int mram_get_nb_bank() { return mram_nb_bank; }
+
+uint32_t mram_get_bank_size() { return mram_pack * mram_slot_size; }
+
+size_t mram_load(uint8_t **mram, unsigned int dpu_id, unsigned int slot)
+{
+    unsigned int virtual_dpu = dpu_id * mram_pack + slot;
+    assert(mram_container != NULL && slot < mram_pack);
+    if (virtual_dpu >= index_get_nb_dpu()) {
+        *mram = NULL;
+        return 0;
+    }
+    *mram = &mram_container[mram_container_directory[virtual_dpu].offset];
+    return mram_container_directory[virtual_dpu].size;
 }
 
 static struct dpu_set_t dpu_set;
-static struct dpu_set_t *dpus;
 static uint32_t nb_dpu_set;
 static struct dpu_symbol_t mram_symbol = { .address = 0x08000000, .size = MRAM_SIZE };
 
-void init_vmis(unsigned int nb_dpu, distribute_index_t *table)
+/* The MRAM images being built are the ones of the DPUs [vmis_group_first, vmis_group_last) */
+static unsigned int vmis_group_first;
+static unsigned int vmis_group_last;
+
+#define MRAM_WRITE_THREAD (8)
+
+static void write_mram_container(uint64_t offset, uint8_t *buffer, size_t size)
+{
+    size_t size_written = 0;
+    while (size_written < size) {
+        ssize_t size_xfer = pwrite(mram_container_fd, &buffer[size_written], size - size_written, offset + size_written);
+        assert(size_xfer > 0);
+        size_written += size_xfer;
+    }
+}
+
+/**
+ * @brief Create the file containing the MRAM images, with its header and directory, and place the images in it.
+ */
+static void create_mram_container(unsigned int nb_dpu)
 {
-    check_ulimit_n(nb_dpu + 16);
+    char *file_name = make_mram_container_name();
+    mram_container_fd = open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (mram_container_fd < 0) {
+        ERROR_EXIT(ERR_FOPEN_FAILED, "Could not open file '%s' (%s)", file_name, strerror(errno));
+    }
+    free(file_name);
 
+    mram_container_header_t header = {
+        .magic = MRAM_CONTAINER_MAGIC,
+        .version = MRAM_CONTAINER_VERSION,
+        .nb_dpu = nb_dpu,
+        .max_size = 0,
+    };
+    mram_container_entry_t *directory = (mram_container_entry_t *)malloc(nb_dpu * sizeof(mram_container_entry_t));
+    assert(directory != NULL);
+
+    uint64_t offset = FILE_SECTION_ALIGN(sizeof(header) + nb_dpu * sizeof(mram_container_entry_t));
+    for (unsigned int each_dpu = 0; each_dpu < nb_dpu; each_dpu++) {
+        vmis[each_dpu].offset = offset;
+        directory[each_dpu].offset = offset;
+        directory[each_dpu].size = vmis[each_dpu].size;
+        header.max_size = MAX(header.max_size, vmis[each_dpu].size);
+        offset = FILE_SECTION_ALIGN(offset + vmis[each_dpu].size);
+    }
+
+    write_mram_container(0, (uint8_t *)&header, sizeof(header));
+    write_mram_container(sizeof(header), (uint8_t *)directory, nb_dpu * sizeof(mram_container_entry_t));
+    assert(ftruncate(mram_container_fd, nb_dpu == 0 ? offset : vmis[nb_dpu - 1].offset + header.max_size) == 0);
+    free(directory);
+}
+
+void init_vmis(unsigned int nb_dpu, distribute_index_t *table)
+{
     vmis = (vmi_t *)calloc(nb_dpu, sizeof(vmi_t));
     assert(vmis != NULL);
+    nb_vmis = nb_dpu;
 
     dpu_error_t err = !DPU_OK;
     if (get_index_with_dpus()) {
         err = dpu_alloc(DPU_ALLOCATE_ALL, "backend=hw", &dpu_set);
     }
     if (err == DPU_OK) {
-        struct dpu_set_t dpu;
-        uint32_t each_dpu;
         DPU_ASSERT(dpu_get_nr_dpus(dpu_set, &nb_dpu_set));
         printf("\t\tUsing %u DPUs to help indexing\n", nb_dpu_set);
         if (nb_dpu_set > nb_dpu) {
             nb_dpu_set = nb_dpu;
         }
-        dpus = (struct dpu_set_t *)malloc(sizeof(struct dpu_set_t) * nb_dpu_set);
-        assert(dpus != NULL);
-        DPU_FOREACH (dpu_set, dpu, each_dpu) {
-            if (each_dpu >= nb_dpu_set) {
-                break;
-            }
-            dpus[each_dpu] = dpu;
-        }
     } else {
         nb_dpu_set = 0;
     }
 
+    coords_and_nbr_size = COORDS_AND_NBR_SIZE(index_get_size_read());
     for (unsigned int i = 0; i < nb_dpu; i++) {
-        vmis[i].size = table[i].size * sizeof(coords_and_nbr_t);
+        vmis[i].size = table[i].size * coords_and_nbr_size;
         assert(vmis[i].size < MRAM_SIZE);
-        if (i >= nb_dpu_set) {
-            vmis[i].buffer = (uint8_t *)malloc(vmis[i].size);
-            assert(vmis[i].buffer != NULL);
+    }
+    create_mram_container(nb_dpu);
+    vmis_group_first = vmis_group_last = 0;
+}
+
+void free_vmis(__attribute__((unused)) unsigned int nb_dpu)
+{
+    if (nb_dpu_set != 0) {
+        DPU_ASSERT(dpu_free(dpu_set));
+    }
+    close(mram_container_fd);
+    mram_container_fd = -1;
+    free(vmis);
+}
+
+/*
+ * The entries of an image arrive in any order, while a rank-parallel transfer writes the same range of the MRAM of every DPU.
+ * The images of the DPUs used to help indexing are thus staged on the host by windows: each walk over the reference genome
+ * fills the same window of every image, which is then pushed to the MRAM. The images are read back once, when the group is
+ * written. Without a memory budget, the window holds the whole images, so that the genome is read once; with a budget, the
+ * host only holds one window for each of these DPUs, at the cost of one walk over the genome per window.
+ */
+#define VMIS_WINDOW_SIZE_MIN (64 << 10)
+
+/* Size of the transfers with the DPUs used to help indexing for the current group, and window of the images being staged */
+static uint32_t vmis_group_xfer_size;
+static uint32_t vmis_window_offset;
+static uint32_t vmis_window_size;
+
+#define XFER_ALIGN(size) (((size) + 7) & ~7)
+
+unsigned int alloc_vmis_group(unsigned int first_dpu, unsigned long long memory_budget)
+{
+    unsigned long long group_size = 0;
+    unsigned int last_dpu = first_dpu;
+
+    /* Every DPU used to help indexing is part of the first group, with a staging window that fits in the budget */
+    vmis_group_xfer_size = 0;
+    while (last_dpu < nb_dpu_set) {
+        vmis_group_xfer_size = MAX(vmis_group_xfer_size, XFER_ALIGN(vmis[last_dpu].size));
+        last_dpu++;
+    }
+    vmis_window_offset = 0;
+    vmis_window_size = 0;
+    if (last_dpu != first_dpu) {
+        /* A multiple of the size of an entry (and of 8 bytes), so that no entry spans two windows */
+        const uint32_t window_unit = coords_and_nbr_size * 8;
+        unsigned long long window_size = vmis_group_xfer_size;
+        if (memory_budget != 0) {
+            window_size = MIN(window_size, MAX(memory_budget / (last_dpu - first_dpu), VMIS_WINDOW_SIZE_MIN));
+        }
+        vmis_window_size = (window_size + window_unit - 1) / window_unit * window_unit;
+        group_size = (unsigned long long)vmis_window_size * (last_dpu - first_dpu);
+        for (unsigned int each_dpu = first_dpu; each_dpu < last_dpu; each_dpu++) {
+            assert(posix_memalign((void **)&vmis[each_dpu].buffer, FILE_SECTION_ALIGNMENT, vmis_window_size) == 0);
         }
     }
+
+    unsigned int first_host_dpu = last_dpu;
+    while (last_dpu < nb_vmis
+        && (memory_budget == 0 || last_dpu == first_dpu || group_size + vmis[last_dpu].size <= memory_budget)) {
+        group_size += vmis[last_dpu].size;
+        last_dpu++;
+    }
+    for (unsigned int each_dpu = first_host_dpu; each_dpu < last_dpu; each_dpu++) {
+        assert(posix_memalign((void **)&vmis[each_dpu].buffer, FILE_SECTION_ALIGNMENT, vmis[each_dpu].size) == 0);
+    }
+
+    vmis_group_first = first_dpu;
+    vmis_group_last = last_dpu;
+    return last_dpu;
 }
 
-void free_vmis(unsigned int nb_dpu)
+bool vmi_in_group(unsigned int num_dpu)
 {
-    uint8_t *tmp_mram = (uint8_t *)malloc(MRAM_SIZE);
-    assert(tmp_mram != NULL);
-    for (unsigned int dpuno = 0; dpuno < nb_dpu_set; dpuno++) {
-        char *file_name = make_mram_file_name(dpuno);
-        FILE *f = fopen(file_name, "w");
-        CHECK_FILE(f, file_name);
-        free(file_name);
-        DPU_ASSERT(dpu_copy_from_symbol(dpus[dpuno], mram_symbol, 0, tmp_mram, vmis[dpuno].size));
-        xfer_file(tmp_mram, vmis[dpuno].size, f, xfer_write);
-        fclose(f);
+    /* The images built on the host are complete after the first walk over the genome */
+    return num_dpu >= vmis_group_first && num_dpu < vmis_group_last && (num_dpu < nb_dpu_set || vmis_window_offset == 0);
+}
+
+/**
+ * @brief Transfer a window of the images of the DPUs used to help indexing of the current group, all at once.
+ */
+static void xfer_vmis_window(dpu_xfer_t direction, uint32_t window_offset)
+{
+    struct dpu_set_t dpu;
+    uint32_t each_dpu;
+    DPU_FOREACH (dpu_set, dpu, each_dpu) {
+        if (each_dpu >= vmis_group_first && each_dpu < nb_dpu_set) {
+            DPU_ASSERT(dpu_prepare_xfer(dpu, vmis[each_dpu].buffer));
+        } else {
+            DPU_ASSERT(dpu_prepare_xfer(dpu, NULL));
+        }
     }
-    for (unsigned int dpuno = nb_dpu_set; dpuno < nb_dpu; dpuno++) {
-        char *file_name = make_mram_file_name(dpuno);
-        FILE *f = fopen(file_name, "w");
-        CHECK_FILE(f, file_name);
-        free(file_name);
-        xfer_file(vmis[dpuno].buffer, vmis[dpuno].size, f, xfer_write);
-        fclose(f);
+    DPU_ASSERT(dpu_push_xfer_symbol(dpu_set, direction, mram_symbol, window_offset,
+        MIN(vmis_window_size, vmis_group_xfer_size - window_offset), DPU_XFER_DEFAULT));
+}
+
+bool flush_vmis_window()
+{
+    if (vmis_group_first >= nb_dpu_set) {
+        return false;
+    }
+    xfer_vmis_window(DPU_XFER_TO_DPU, vmis_window_offset);
+    vmis_window_offset += vmis_window_size;
+    return vmis_window_offset < vmis_group_xfer_size;
+}
+
+static void *write_vmis_group_fct(void *arg)
+{
+    unsigned int thread_id = (unsigned int)(uintptr_t)arg;
+    unsigned int first_dpu = MAX(vmis_group_first, nb_dpu_set);
+    for (unsigned int dpuno = first_dpu + thread_id; dpuno < vmis_group_last; dpuno += MRAM_WRITE_THREAD) {
+        write_mram_container(vmis[dpuno].offset, vmis[dpuno].buffer, vmis[dpuno].size);
         free(vmis[dpuno].buffer);
+        vmis[dpuno].buffer = NULL;
     }
+    return NULL;
+}
 
-    free(tmp_mram);
-    free(vmis);
+void write_vmis_group()
+{
+    pthread_t thread_id[MRAM_WRITE_THREAD];
+    for (unsigned int each_thread = 0; each_thread < MRAM_WRITE_THREAD; each_thread++) {
+        assert(pthread_create(&thread_id[each_thread], NULL, write_vmis_group_fct, (void *)(uintptr_t)each_thread) == 0);
+    }
+
+    /* The images of the DPUs used to help indexing are read back from their MRAM, one window at a time */
+    if (vmis_group_first < nb_dpu_set) {
+        for (uint32_t window_offset = 0; window_offset < vmis_group_xfer_size; window_offset += vmis_window_size) {
+            xfer_vmis_window(DPU_XFER_FROM_DPU, window_offset);
+            for (unsigned int each_dpu = vmis_group_first; each_dpu < nb_dpu_set; each_dpu++) {
+                if (window_offset < vmis[each_dpu].size) {
+                    write_mram_container(vmis[each_dpu].offset + window_offset, vmis[each_dpu].buffer,
+                        MIN(vmis_window_size, vmis[each_dpu].size - window_offset));
+                }
+            }
+        }
+        for (unsigned int each_dpu = vmis_group_first; each_dpu < nb_dpu_set; each_dpu++) {
+            free(vmis[each_dpu].buffer);
+            vmis[each_dpu].buffer = NULL;
+        }
+    }
+
+    for (unsigned int each_thread = 0; each_thread < MRAM_WRITE_THREAD; each_thread++) {
+        assert(pthread_join(thread_id[each_thread], NULL) == 0);
+    }
+    vmis_group_first = vmis_group_last;
 }
 
 void write_vmi(unsigned int num_dpu, unsigned int num_ref, coords_and_nbr_t *coords_and_nbr)
 {
-    uint32_t offset = sizeof(coords_and_nbr_t) * num_ref;
-    assert(offset < vmis[num_dpu].size);
+    uint32_t offset = coords_and_nbr_size * num_ref;
+    assert(offset < vmis[num_dpu].size && vmi_in_group(num_dpu));
     if (num_dpu < nb_dpu_set) {
-        DPU_ASSERT(dpu_copy_to_symbol(dpus[num_dpu], mram_symbol, offset, coords_and_nbr, sizeof(*coords_and_nbr)));
+        if (offset >= vmis_window_offset && offset < vmis_window_offset + vmis_window_size) {
+            memcpy(&vmis[num_dpu].buffer[offset - vmis_window_offset], coords_and_nbr, coords_and_nbr_size);
+        }
         return;
     }
-    coords_and_nbr_t *buffer = (coords_and_nbr_t *)&vmis[num_dpu].buffer[offset];
-    memcpy(buffer, coords_and_nbr, sizeof(*coords_and_nbr));
+    memcpy(&vmis[num_dpu].buffer[offset], coords_and_nbr, coords_and_nbr_size);
 }
@@ -0,0 +1,101 @@
+/**
+ * Copyright 2016-2019 - Dominique Lavenier & UPMEM
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NUCLEOTIDE_SIMD
+#endif
+
+#include "nucleotide.h"
+
+#define CODE_N (4)
+/* The complement of a nucleotide is obtained by flipping the 2nd bit: A(0) <-> T(2), C(1) <-> G(3) */
+#define COMPLEMENT(code) ((code) ^ 2)
+
+static void nucleotide_encode_scalar(const char *ascii, size_t len, int8_t *code, int8_t *rev, bool mask_n)
+{
+    for (size_t i = 0; i < len; i++) {
+        int8_t c = (((int)ascii[i]) >> 1) & 3;
+        if (mask_n && ascii[i] == 'N') {
+            c = CODE_N;
+        }
+        code[i] = c;
+        if (rev != NULL) {
+            rev[len - 1 - i] = COMPLEMENT(c);
+        }
+    }
+}
+
+#ifdef NUCLEOTIDE_SIMD
+__attribute__((target("avx2"))) static void nucleotide_encode_avx2(
+    const char *ascii, size_t len, int8_t *code, int8_t *rev, bool mask_n)
+{
+    const __m256i mask = _mm256_set1_epi8(3);
+    const __m256i complement = _mm256_set1_epi8(2);
+    const __m256i ascii_n = _mm256_set1_epi8('N');
+    const __m256i code_n = _mm256_set1_epi8(CODE_N);
+    const __m256i reverse = _mm256_setr_epi8(
+        15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i in = _mm256_loadu_si256((const __m256i *)&ascii[i]);
+        __m256i c = _mm256_and_si256(_mm256_srli_epi16(in, 1), mask);
+        if (mask_n) {
+            c = _mm256_blendv_epi8(c, code_n, _mm256_cmpeq_epi8(in, ascii_n));
+        }
+        _mm256_storeu_si256((__m256i *)&code[i], c);
+        if (rev != NULL) {
+            __m256i r = _mm256_shuffle_epi8(_mm256_xor_si256(c, complement), reverse);
+            r = _mm256_permute4x64_epi64(r, 0x4e);
+            _mm256_storeu_si256((__m256i *)&rev[len - i - 32], r);
+        }
+    }
+    nucleotide_encode_scalar(&ascii[i], len - i, &code[i], rev, mask_n);
+}
+
+__attribute__((target("ssse3"))) static void nucleotide_encode_ssse3(
+    const char *ascii, size_t len, int8_t *code, int8_t *rev, bool mask_n)
+{
+    const __m128i mask = _mm_set1_epi8(3);
+    const __m128i complement = _mm_set1_epi8(2);
+    const __m128i ascii_n = _mm_set1_epi8('N');
+    const __m128i code_n = _mm_set1_epi8(CODE_N);
+    const __m128i reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *)&ascii[i]);
+        __m128i c = _mm_and_si128(_mm_srli_epi16(in, 1), mask);
+        if (mask_n) {
+            __m128i is_n = _mm_cmpeq_epi8(in, ascii_n);
+            c = _mm_or_si128(_mm_andnot_si128(is_n, c), _mm_and_si128(is_n, code_n));
+        }
+        _mm_storeu_si128((__m128i *)&code[i], c);
+        if (rev != NULL) {
+            __m128i r = _mm_shuffle_epi8(_mm_xor_si128(c, complement), reverse);
+            _mm_storeu_si128((__m128i *)&rev[len - i - 16], r);
+        }
+    }
+    nucleotide_encode_scalar(&ascii[i], len - i, &code[i], rev, mask_n);
+}
+#endif
+
+void nucleotide_encode(const char *ascii, size_t len, int8_t *code, int8_t *rev, bool mask_n)
+{
+#ifdef NUCLEOTIDE_SIMD
+    if (__builtin_cpu_supports("avx2")) {
+        nucleotide_encode_avx2(ascii, len, code, rev, mask_n);
+        return;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        nucleotide_encode_ssse3(ascii, len, code, rev, mask_n);
+        return;
+    }
+#endif
+    nucleotide_encode_scalar(ascii, len, code, rev, mask_n);
+}
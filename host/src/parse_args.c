@@ -28,6 +28,10 @@ static bool index_with_dpus = false;
 static goal_t goal = goal_unknown;
 static unsigned int nb_dpu = DPU_ALLOCATE_ALL;
 static unsigned int nb_thread_for_simu = UINT_MAX;
+static unsigned int size_read = 0;
+static unsigned long long work_budget = 0;
+static unsigned long long memory_budget = 0;
+static unsigned int nb_virtual_dpu_per_dpu = 0;
 
 /**************************************************************************************/
 /**************************************************************************************/
@@ -35,14 +39,19 @@ static void usage()
 {
     ERROR_EXIT(ERR_USAGE,
         "\nusage: %s -i <input_prefix> -g <goal> [ -s [ -t <number_of_thread_for_dpu_simulation> ] | -n <number_of_dpus>] [ -d "
-        "]\n"
+        "] [ -r <size_of_reads> ] [ -w <work_budget> ] [ -m <memory_budget> ] [ -p <number_of_virtual_dpus_per_dpu> ]\n"
         "options:\n"
         "\t-i\tInput prefix that will be used to find the inputs files\n"
-        "\t-g\tGoal of the run - values=index|map\n"
+        "\t-g\tGoal of the run - values=index|map|bench (bench measures the seed lookups in the index)\n"
         "\t-d\tTry to use Hardware DPU to help indexing\n"
         "\t-s\tSimulation mode (not compatible with -n)\n"
         "\t-t\tNumber of thread to use to simulate DPUs (only in simulation mode) (default: 1/2 of the threads of the system)\n"
-        "\t-n\tNumber of DPUs to use when not in simulation mode (default: use all available DPUs)\n",
+        "\t-n\tNumber of DPUs to use when not in simulation mode (default: use all available DPUs)\n"
+        "\t-r\tSize of the reads to index for - values=120|150 (only when indexing) (default: 120)\n"
+        "\t-w\tMaximum number of neighbours to compare on a DPU in a pass (only when mapping) (default: no limit)\n"
+        "\t-m\tMaximum size in MB of the requests of a pass on the host when mapping, of the MRAM images built at once on the "
+        "host when indexing (default: no limit)\n"
+        "\t-p\tNumber of virtual DPUs of the index to pack in the MRAM of each DPU (only when mapping) (default: 1)\n",
         prog_name);
 }
 
@@ -64,9 +73,25 @@ static void check_args()
             ERROR("cannot index for 0 dpus");
             usage();
         }
+        if (size_read == 0) {
+            size_read = 120;
+        }
     } else if (index_with_dpus) {
         ERROR("-d is not compatible with mapping");
         usage();
+    } else if (size_read != 0) {
+        ERROR("-r is not compatible with mapping (the size of the reads is the one of the index)");
+        usage();
+    }
+    if (goal == goal_index && work_budget != 0) {
+        ERROR("-w is not compatible with indexing");
+        usage();
+    }
+    if (goal == goal_index && nb_virtual_dpu_per_dpu != 0) {
+        ERROR("-p is not compatible with indexing");
+        usage();
+    } else if (nb_virtual_dpu_per_dpu == 0) {
+        nb_virtual_dpu_per_dpu = 1;
     }
     if (simulation_mode && nb_thread_for_simu == UINT_MAX) {
         nb_thread_for_simu = get_nprocs() / 2;
@@ -107,6 +132,8 @@ static void validate_goal(const char *goal_str)
         goal = goal_index;
     } else if (strcmp(goal_str, "map") == 0) {
         goal = goal_map;
+    } else if (strcmp(goal_str, "bench") == 0) {
+        goal = goal_bench;
     } else {
         ERROR("unknown goal value");
         usage();
@@ -162,6 +189,59 @@ static void validate_nb_thread_for_simu(const char *nb_thread_for_simu_str)
 
 unsigned int get_nb_thread_for_simu() { return nb_thread_for_simu; }
 
+/**************************************************************************************/
+/**************************************************************************************/
+static void validate_size_read(const char *size_read_str)
+{
+    if (size_read != 0) {
+        ERROR("size of reads option has been entered more than once");
+        usage();
+    }
+    size_read = (unsigned int)atoi(size_read_str);
+    if (!size_read_supported(size_read)) {
+        ERROR("unsupported size of reads");
+        usage();
+    }
+}
+
+unsigned int get_size_read() { return size_read; }
+
+/**************************************************************************************/
+/**************************************************************************************/
+static void validate_budget(unsigned long long *budget, const char *budget_str, unsigned long long unit)
+{
+    if (*budget != 0) {
+        ERROR("budget option has been entered more than once");
+        usage();
+    }
+    *budget = strtoull(budget_str, NULL, 10) * unit;
+    if (*budget == 0) {
+        ERROR("budget should be greater than 0");
+        usage();
+    }
+}
+
+unsigned long long get_work_budget() { return work_budget; }
+
+unsigned long long get_memory_budget() { return memory_budget; }
+
+/**************************************************************************************/
+/**************************************************************************************/
+static void validate_nb_virtual_dpu_per_dpu(const char *nb_virtual_dpu_per_dpu_str)
+{
+    if (nb_virtual_dpu_per_dpu != 0) {
+        ERROR("number of virtual DPUs per DPU option has been entered more than once");
+        usage();
+    }
+    nb_virtual_dpu_per_dpu = (unsigned int)atoi(nb_virtual_dpu_per_dpu_str);
+    if (nb_virtual_dpu_per_dpu == 0) {
+        ERROR("number of virtual DPUs per DPU should be greater than 0");
+        usage();
+    }
+}
+
+unsigned int get_nb_virtual_dpu_per_dpu() { return nb_virtual_dpu_per_dpu; }
+
 /**************************************************************************************/
 /**************************************************************************************/
 void validate_args(int argc, char **argv)
@@ -172,7 +252,7 @@ void validate_args(int argc, char **argv)
     prog_name = strdup(argv[0]);
     check_permission();
 
-    while ((opt = getopt(argc, argv, "dfsi:g:n:t:")) != -1) {
+    while ((opt = getopt(argc, argv, "dfsi:g:m:n:p:r:t:w:")) != -1) {
         switch (opt) {
         case 'd':
             validate_index_with_dpus_mode();
@@ -195,6 +275,18 @@ void validate_args(int argc, char **argv)
         case 'f':
             validate_no_filter();
             break;
+        case 'r':
+            validate_size_read(optarg);
+            break;
+        case 'w':
+            validate_budget(&work_budget, optarg, 1ULL);
+            break;
+        case 'm':
+            validate_budget(&memory_budget, optarg, 1ULL << 20);
+            break;
+        case 'p':
+            validate_nb_virtual_dpu_per_dpu(optarg);
+            break;
         default:
             ERROR("unknown option");
             usage();
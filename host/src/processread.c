@@ -11,6 +11,7 @@
 #include "accumulateread.h"
 #include "genome.h"
 #include "getread.h"
+#include "index.h"
 #include "processread.h"
 #include "upvc.h"
 #include "vartree.h"
@@ -205,7 +206,7 @@ int DPD(int8_t *s1, int8_t *s2, backtrack_t *backtrack, int size_neighbour_in_sy
 static int code_alignment(uint8_t *code, int score, int8_t *gen, int8_t *read, unsigned size_neighbour_in_symbols)
 {
     int code_idx, computed_score, backtrack_idx;
-    int size_read = SIZE_READ;
+    int size_read = index_get_size_read();
     int size_neighbour = size_neighbour_in_symbols;
     backtrack_t backtrak[size_read];
 
@@ -283,11 +284,13 @@ static void set_variant(
     int8_t *read;
     char nucleotide[4] = { 'A', 'C', 'T', 'G' };
     uint64_t genome_pos = ref_genome->pt_seq[result_match.coord.seq_nr] + result_match.coord.seed_nr;
-    int size_read = SIZE_READ;
+    int size_read = index_get_size_read();
 
     /* Get the differences betweend the read and the sequence of the reference genome that match */
+    int8_t gen[size_read];
+    genome_get_bases(ref_genome, genome_pos, size_read, gen);
     read = &reads_buffer[result_match.num * size_read];
-    code_alignment(code_result_tab, result_match.score, &ref_genome->data[genome_pos], read, size_neighbour_in_symbols);
+    code_alignment(code_result_tab, result_match.score, gen, read, size_neighbour_in_symbols);
     if (code_result_tab[0] == CODE_ERR)
         return;
 
@@ -310,7 +313,7 @@ static void set_variant(
         if (code_result == CODE_SUB) {
             /* SNP = 0,1,2,3  (code A,C,T,G) */
             int snp = code_result_tab[code_result_idx + 2];
-            newvar->ref[ref_pos++] = nucleotide[ref_genome->data[pos_variant_genome] & 3];
+            newvar->ref[ref_pos++] = nucleotide[genome_get_base(ref_genome, pos_variant_genome) & 3];
             newvar->alt[alt_pos++] = nucleotide[snp & 3];
 
             code_result_idx += 3;
@@ -324,14 +327,14 @@ static void set_variant(
                 code_result_idx++;
             }
 
-            while (ref_genome->data[ps_var_genome] == read[ps_var_read]) {
+            while (genome_get_base(ref_genome, ps_var_genome) == read[ps_var_read]) {
                 ps_var_genome--;
                 ps_var_read--;
                 pos_variant_genome--;
                 pos_variant_read--;
             }
 
-            newvar->ref[ref_pos++] = nucleotide[ref_genome->data[pos_variant_genome] & 3];
+            newvar->ref[ref_pos++] = nucleotide[genome_get_base(ref_genome, pos_variant_genome) & 3];
 
             while (pos_variant_read <= ps_var_read) {
                 newvar->alt[alt_pos++] = nucleotide[read[pos_variant_read] & 3];
@@ -352,17 +355,17 @@ static void set_variant(
                 code_result_idx++;
             }
 
-            while (ref_genome->data[ps_var_genome] == read[ps_var_read]) {
+            while (genome_get_base(ref_genome, ps_var_genome) == read[ps_var_read]) {
                 ps_var_read--;
                 ps_var_genome--;
                 pos_variant_genome--;
                 pos_variant_read--;
             }
 
-            newvar->alt[alt_pos++] = nucleotide[ref_genome->data[pos_variant_genome] & 3];
+            newvar->alt[alt_pos++] = nucleotide[genome_get_base(ref_genome, pos_variant_genome) & 3];
 
             while (pos_variant_genome <= ps_var_genome) {
-                newvar->ref[ref_pos++] = nucleotide[ref_genome->data[pos_variant_genome] & 3];
+                newvar->ref[ref_pos++] = nucleotide[genome_get_base(ref_genome, pos_variant_genome) & 3];
                 if (ref_pos >= MAX_SIZE_ALLELE - 1) {
                     free(newvar);
                     return;
@@ -385,7 +388,7 @@ static void add_to_non_mapped_read(int numread, int round, FILE *fpe1, FILE *fpe
         return;
     pthread_mutex_lock(&non_mapped_mutex);
     char nucleotide[4] = { 'A', 'C', 'T', 'G' };
-    int size_read = SIZE_READ;
+    int size_read = index_get_size_read();
     int8_t *read = &reads_buffer[numread * size_read];
     fprintf(fpe1, ">>%d\n", SIZE_SEED * (round + 1));
     for (int j = SIZE_SEED; j < size_read; j++) {
@@ -446,7 +449,7 @@ static void do_process_read(process_read_arg_t *arg)
     genome_t *ref_genome = arg->ref_genome;
     FILE *fpe1 = arg->fpe1;
     FILE *fpe2 = arg->fpe2;
-    unsigned int size_neighbour_in_symbols = (SIZE_NEIGHBOUR_IN_BYTES - DELTA_NEIGHBOUR(round)) * 4;
+    unsigned int size_neighbour_in_symbols = SIZE_IN_SYMBOLS_OF(index_get_size_read(), DELTA_NEIGHBOUR(round));
 
     /*
      * The number of a pair is given by "num_read / 4 " (see dispatch_read function)
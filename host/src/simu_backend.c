@@ -23,7 +23,12 @@
 
 #define FOREACH_THREAD(it) for (unsigned int it = 0; it < get_nb_thread_for_simu(); it++)
 
-static coords_and_nbr_t **mrams;
+/* MRAM images of the virtual DPUs packed in each simulated DPU, nb_slot per DPU, for each bank of the index, and the ones of
+ * the bank used by the run. The size of their slots is in neighbours. */
+static uint8_t **mram_banks[MRAM_NB_BANK_MAX];
+static uint8_t **mrams;
+static unsigned int nb_slot;
+static uint32_t slot_nb_neighbours;
 static const int delta_neighbour = 0;
 
 static pthread_barrier_t barrier;
@@ -145,10 +150,9 @@ static int translation_table[256] = { 0, 10, 10, 10, 10, 20, 20, 20, 10, 20, 20,
  * @brief Optimized version of ODPD (if no INDELS)
  * If it detects INDELS, return -1. In this case we will need the run the full ODPD.
  */
-static int noDP(int8_t *s1, int8_t *s2, int max_score)
+static inline int noDP(int8_t *s1, int8_t *s2, int max_score, const int size_neighbour)
 {
     int score = 0;
-    int size_neighbour = SIZE_NEIGHBOUR_IN_BYTES;
     for (int i = 0; i < size_neighbour - delta_neighbour; i++) {
         int s_xor = ((int)(s1[i] ^ s2[i])) & 0xFF;
         int s_translated = translation_table[s_xor];
@@ -191,26 +195,37 @@ static int noDP(int8_t *s1, int8_t *s2, int max_score)
     return score;
 }
 
-static void align_on_dpu(unsigned int dpu_offset, unsigned rank_id, int pass_id)
+typedef void (*align_on_dpu_fct_t)(unsigned int dpu_offset, unsigned rank_id, int pass_id);
+static align_on_dpu_fct_t align_on_dpu;
+
+static inline void align_on_dpu_kernel(unsigned int dpu_offset, unsigned rank_id, int pass_id, const unsigned int size_read)
 {
     int nb_map = 0;
     int numdpu = dpu_offset + rank_id;
-    if (numdpu >= (int)index_get_nb_dpu())
+    if (numdpu >= (int)mram_get_nb_dpu())
         return;
-    int size_neighbour_in_symbols = SIZE_IN_SYMBOLS(delta_neighbour);
+    int size_neighbour_in_symbols = SIZE_IN_SYMBOLS_OF(size_read, delta_neighbour);
     dispatch_request_t *requests = dispatch_get(numdpu, pass_id);
-    acc_results_t *acc_res = accumulate_get_buffer(rank_id, pass_id);
+    acc_results_t *acc_res = accumulate_reserve_buffer(rank_id, pass_id, dispatch_nb_launch(requests->nb_reads));
+    int nb_map_launch = 0;
 
     for (unsigned int each_request_read = 0; each_request_read < requests->nb_reads; each_request_read++) {
-        dpu_request_t *curr_request = &(requests->dpu_requests[each_request_read]);
+        if (each_request_read % MAX_DPU_REQUEST == 0) {
+            /* Start of a new launch of the DPU, which can hold MAX_DPU_RESULTS results again */
+            nb_map_launch = nb_map;
+        }
+        dpu_request_t *curr_request = dispatch_get_request(requests, each_request_read, size_read);
         int min = MAX_SCORE;
         int nb_map_start = nb_map;
         int8_t *curr_read = (int8_t *)&curr_request->nbr[0];
+        unsigned int slot = curr_request->offset / slot_nb_neighbours;
+        uint8_t *mram = mrams[rank_id * nb_slot + slot];
+        uint32_t offset = curr_request->offset - slot * slot_nb_neighbours;
         for (unsigned int nb_neighbour = 0; nb_neighbour < curr_request->count; nb_neighbour++) {
-            coords_and_nbr_t *coord_and_nbr = &(mrams[rank_id][curr_request->offset + nb_neighbour]);
+            coords_and_nbr_t *coord_and_nbr = (coords_and_nbr_t *)&mram[(offset + nb_neighbour) * COORDS_AND_NBR_SIZE(size_read)];
             int8_t *curr_nbr = (int8_t *)&coord_and_nbr->nbr[0];
 
-            int score = noDP(curr_read, curr_nbr, min);
+            int score = noDP(curr_read, curr_nbr, min, SIZE_NEIGHBOUR_IN_BYTES_OF(size_read));
             if (score == -1) {
                 score = ODPD(curr_read, curr_nbr, min, size_neighbour_in_symbols);
             }
@@ -222,7 +237,7 @@ static void align_on_dpu(unsigned int dpu_offset, unsigned rank_id, int pass_id)
                 nb_map = nb_map_start;
             }
 
-            if (nb_map >= MAX_DPU_RESULTS - 1) {
+            if (nb_map - nb_map_launch >= MAX_DPU_RESULTS - 1) {
                 ERROR_EXIT(ERR_SIMU_MAX_RESULTS_REACHED, "%s:[P%u, DPU#%u]: MAX_DPU_RESULTS reached!", __func__, pass_id, numdpu);
             }
 
@@ -237,6 +252,22 @@ static void align_on_dpu(unsigned int dpu_offset, unsigned rank_id, int pass_id)
     acc_res->nb_res = nb_map;
 }
 
+#define ALIGN_ON_DPU(size_read, unused)                                                                                          \
+    static void align_on_dpu_##size_read(unsigned int dpu_offset, unsigned rank_id, int pass_id)                                \
+    {                                                                                                                            \
+        align_on_dpu_kernel(dpu_offset, rank_id, pass_id, size_read);                                                            \
+    }
+FOREACH_SIZE_READ(ALIGN_ON_DPU, )
+
+static align_on_dpu_fct_t select_align_on_dpu(unsigned int size_read)
+{
+    switch (size_read) {
+        FOREACH_SIZE_READ(SIZE_READ_KERNEL_CASE, align_on_dpu)
+    default:
+        ERROR_EXIT(ERR_SIZE_READ_NOT_SUPPORTED, "%s: reads of %u symbols are not supported", __func__, size_read);
+    }
+}
+
 static void *align_on_dpu_fct(void *arg) {
     const unsigned int dpu_id = (unsigned int)(uintptr_t)arg;
 
@@ -260,17 +291,25 @@ void run_dpu_simulation(unsigned int dpu_offset, unsigned int pass_id, sem_t *di
     pthread_barrier_wait(&barrier);
     pthread_barrier_wait(&barrier);
 
-    sem_post(dispatch_free_sem);
-    sem_post(exec_to_acc_sem);
+    sem_post(&dispatch_free_sem[0]);
+    sem_post(&exec_to_acc_sem[0]);
     sem_wait(dispatch_to_exec_sem);
 }
 
-void init_backend_simulation(unsigned int *nb_dpus_per_run)
+void init_backend_simulation(unsigned int *nb_dpus_per_run, unsigned int *nb_ranks_per_run)
 {
     unsigned int nb_thread_for_simu = get_nb_thread_for_simu();
     *nb_dpus_per_run = nb_thread_for_simu;
-    mrams = (coords_and_nbr_t **)calloc(nb_thread_for_simu, sizeof(coords_and_nbr_t *));
-    assert(mrams != NULL);
+    /* All the simulated DPUs run each pass together, as a single rank */
+    *nb_ranks_per_run = 1;
+    align_on_dpu = select_align_on_dpu(index_get_size_read());
+    nb_slot = mram_get_nb_slot();
+    slot_nb_neighbours = mram_get_slot_size() / COORDS_AND_NBR_SIZE(index_get_size_read());
+    for (unsigned int each_bank = 0; each_bank < mram_get_nb_bank(); each_bank++) {
+        mram_banks[each_bank] = (uint8_t **)calloc(nb_thread_for_simu * nb_slot, sizeof(uint8_t *));
+        assert(mram_banks[each_bank] != NULL);
+    }
+    mrams = mram_banks[0];
 
     tids = malloc(nb_thread_for_simu * sizeof(pthread_t));
     assert(tids != NULL);
@@ -294,23 +333,27 @@ void free_backend_simulation()
     {
         int ret = pthread_join(tids[each_dpu], NULL);
         assert(ret == 0);
-        free(mrams[each_dpu]);
     }
 
     free(tids);
-    free(mrams);
+    for (unsigned int each_bank = 0; each_bank < mram_get_nb_bank(); each_bank++) {
+        free(mram_banks[each_bank]);
+    }
 }
 
-void load_mram_simulation(unsigned int dpu_offset, __attribute__((unused)) int _delta_neighbour)
+void load_mram_simulation(unsigned int dpu_offset, unsigned int bank)
 {
     FOREACH_THREAD(each_dpu)
     {
         unsigned int dpu_id = dpu_offset + each_dpu;
-        if (dpu_id >= index_get_nb_dpu())
+        if (dpu_id >= mram_get_nb_dpu())
             return;
-        free(mrams[each_dpu]);
-        mram_load((uint8_t **)&mrams[each_dpu], dpu_id);
+        for (unsigned int each_slot = 0; each_slot < nb_slot; each_slot++) {
+            mram_load(&mram_banks[bank][each_dpu * nb_slot + each_slot], dpu_id, each_slot);
+        }
     }
 }
 
+void select_mram_simulation(unsigned int bank, __attribute__((unused)) int _delta_neighbour) { mrams = mram_banks[bank]; }
+
 void wait_dpu_simulation() { return; }
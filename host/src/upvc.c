@@ -3,6 +3,7 @@
  */
 
 #define _POSIX_C_SOURCE 200809L
+#include <limits.h>
 #include <semaphore.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,6 +17,7 @@
 #include "genome.h"
 #include "getread.h"
 #include "index.h"
+#include "mram_dpu.h"
 #include "parse_args.h"
 #include "processread.h"
 #include "simu_backend.h"
@@ -25,17 +27,22 @@
 #include "backends_functions.h"
 
 unsigned int nb_dpus_per_run;
+static unsigned int nb_ranks_per_run;
 
 static backends_functions_t backends_functions;
 static unsigned int round;
 static FILE *fipe1, *fipe2, *fope1, *fope2;
-static sem_t getreads_to_dispatch_sem, dispatch_to_exec_sem, exec_to_dispatch_sem, exec_to_acc_sem, acc_to_exec_sem,
-    accprocess_to_getreads_sem, acc_to_process_sem;
-
-#define LAST_RUN(dpu_offset) (((dpu_offset) + nb_dpus_per_run) >= index_get_nb_dpu())
-#define FOREACH_RUN(dpu_offset) for (unsigned int dpu_offset = 0; dpu_offset < index_get_nb_dpu(); dpu_offset += nb_dpus_per_run)
+static sem_t getreads_to_dispatch_sem, dispatch_to_exec_sem, acc_to_exec_sem, accprocess_to_getreads_sem, acc_to_process_sem;
+/* The hand-offs of the DPUs to the dispatch and the accumulation have one semaphore for each rank, posted by the rank itself.
+ * A pass is still dispatched and accumulated for all the ranks at once: a rank can only run ahead of the slowest one by
+ * NB_DISPATCH_AND_ACC_BUFFER passes, and the end of each run synchronizes all the ranks */
+static sem_t exec_to_dispatch_sem[NB_RANKS_MAX], exec_to_acc_sem[NB_RANKS_MAX];
+
+#define LAST_RUN(dpu_offset) (((dpu_offset) + nb_dpus_per_run) >= mram_get_nb_dpu())
+#define FOREACH_RUN(dpu_offset) for (unsigned int dpu_offset = 0; dpu_offset < mram_get_nb_dpu(); dpu_offset += nb_dpus_per_run)
 #define FOREACH_PASS(each_pass) for (unsigned int each_pass = 0; get_reads_in_buffer(each_pass) != 0; each_pass++)
 #define FOR(loop) for (int _i = 0; _i < (loop); _i++)
+#define FOREACH_RANK(each_rank) for (unsigned int each_rank = 0; each_rank < nb_ranks_per_run; each_rank++)
 
 void *thread_get_reads(__attribute__((unused)) void *arg)
 {
@@ -46,12 +53,11 @@ void *thread_get_reads(__attribute__((unused)) void *arg)
         unsigned int each_pass = 0;
         do {
             sem_wait(&accprocess_to_getreads_sem);
-            get_reads(fipe1, fipe2, each_pass);
+            get_reads(each_pass);
             sem_post(&getreads_to_dispatch_sem);
         } while (get_reads_in_buffer(each_pass++) != 0);
 
-        fseek(fipe1, 0, SEEK_SET);
-        fseek(fipe2, 0, SEEK_SET);
+        get_reads_rewind();
 
         FOR(NB_READS_BUFFER) { sem_wait(&accprocess_to_getreads_sem); }
     }
@@ -59,25 +65,87 @@ void *thread_get_reads(__attribute__((unused)) void *arg)
     return NULL;
 }
 
+#define NO_RUN (UINT_MAX)
+
+/* First DPU of the run whose index is in each bank of the MRAM, and bank used by the current run */
+static unsigned int bank_dpu_offset[MRAM_NB_BANK_MAX] = { NO_RUN, NO_RUN };
+static unsigned int current_bank;
+
+/**
+ * @brief First DPU of the run after the one starting at "dpu_offset", in this round or in the next one (NO_RUN if none).
+ */
+static unsigned int next_run(unsigned int dpu_offset)
+{
+    if (!LAST_RUN(dpu_offset)) {
+        return dpu_offset + nb_dpus_per_run;
+    }
+    return round + 1 < NB_ROUND ? 0 : NO_RUN;
+}
+
+/**
+ * @brief Get the bank of the MRAM holding the index of a run (NO_RUN if it is not loaded).
+ */
+static unsigned int get_bank(unsigned int dpu_offset)
+{
+    for (unsigned int each_bank = 0; each_bank < mram_get_nb_bank(); each_bank++) {
+        if (bank_dpu_offset[each_bank] == dpu_offset) {
+            return each_bank;
+        }
+    }
+    return NO_RUN;
+}
+
+/**
+ * @brief Load the index of a run in a bank of the MRAM, then start prefetching the images of the run after it.
+ */
+static void load_run(unsigned int dpu_offset, unsigned int bank)
+{
+    double hidden_time;
+    if (mram_prefetch_wait(&hidden_time)) {
+        printf("\tMRAM prefetch of run %u: %lf s hidden\n", dpu_offset / nb_dpus_per_run, hidden_time);
+    }
+    backends_functions.load_mram(dpu_offset, bank);
+    bank_dpu_offset[bank] = dpu_offset;
+
+    unsigned int next_dpu_offset = next_run(dpu_offset);
+    if (next_dpu_offset != NO_RUN && next_dpu_offset != dpu_offset) {
+        mram_prefetch(next_dpu_offset, nb_dpus_per_run);
+    }
+}
+
 void exec_dpus()
 {
     const unsigned int delta_neighbour = (SIZE_SEED * round) / 4;
+    const unsigned int nb_bank = mram_get_nb_bank();
 
     FOREACH_RUN(dpu_offset)
     {
-        backends_functions.load_mram(dpu_offset, delta_neighbour);
+        /* The index of the run can already be in a bank, loaded during the previous run or kept from the previous round */
+        unsigned int bank = get_bank(dpu_offset);
+        if (bank == NO_RUN) {
+            bank = (current_bank + 1) % nb_bank;
+            load_run(dpu_offset, bank);
+        }
+        current_bank = bank;
+        backends_functions.select_mram(bank, delta_neighbour);
 
         sem_wait(&dispatch_to_exec_sem);
 
         FOREACH_PASS(each_pass)
         {
             backends_functions.run_dpu(
-                dpu_offset, each_pass, &exec_to_dispatch_sem, &acc_to_exec_sem, &exec_to_acc_sem, &dispatch_to_exec_sem);
+                dpu_offset, each_pass, exec_to_dispatch_sem, &acc_to_exec_sem, exec_to_acc_sem, &dispatch_to_exec_sem);
+
+            /* Load the index of the next run in the other bank, between the passes of this one */
+            unsigned int next_dpu_offset = next_run(dpu_offset);
+            if (each_pass == 0 && nb_bank > 1 && next_dpu_offset != NO_RUN && get_bank(next_dpu_offset) == NO_RUN) {
+                load_run(next_dpu_offset, (bank + 1) % nb_bank);
+            }
         }
 
         backends_functions.wait_dpu();
 
-        sem_post(&exec_to_acc_sem);
+        FOREACH_RANK(each_rank) { sem_post(&exec_to_acc_sem[each_rank]); }
     }
 }
 
@@ -87,13 +155,14 @@ void *thread_dispatch(__attribute__((unused)) void *arg)
     {
         FOR(NB_DISPATCH_AND_ACC_BUFFER)
         {
-            sem_post(&exec_to_dispatch_sem);
+            FOREACH_RANK(each_rank) { sem_post(&exec_to_dispatch_sem[each_rank]); }
         }
 
         sem_wait(&getreads_to_dispatch_sem);
         FOREACH_PASS(each_pass)
         {
-            sem_wait(&exec_to_dispatch_sem);
+            /* The buffer of the pass holds the requests of every rank: it is reused once every rank is done with it */
+            FOREACH_RANK(each_rank) { sem_wait(&exec_to_dispatch_sem[each_rank]); }
             dispatch_read(each_pass);
             sem_post(&dispatch_to_exec_sem);
             sem_wait(&getreads_to_dispatch_sem);
@@ -103,7 +172,7 @@ void *thread_dispatch(__attribute__((unused)) void *arg)
 
         FOR(NB_DISPATCH_AND_ACC_BUFFER)
         {
-            sem_wait(&exec_to_dispatch_sem);
+            FOREACH_RANK(each_rank) { sem_wait(&exec_to_dispatch_sem[each_rank]); }
         }
     }
     return NULL;
@@ -118,7 +187,7 @@ void *thread_acc(__attribute__((unused)) void *arg)
             sem_post(&acc_to_exec_sem);
         }
 
-        sem_wait(&exec_to_acc_sem);
+        FOREACH_RANK(each_rank) { sem_wait(&exec_to_acc_sem[each_rank]); }
 
         FOREACH_PASS(each_pass)
         {
@@ -130,17 +199,19 @@ void *thread_acc(__attribute__((unused)) void *arg)
             } else {
                 sem_post(&accprocess_to_getreads_sem);
             }
-            sem_wait(&exec_to_acc_sem);
+            FOREACH_RANK(each_rank) { sem_wait(&exec_to_acc_sem[each_rank]); }
+        }
+        /* Take back the tokens of acc_to_exec_sem before letting the next run start, otherwise exec_dpus could take them
+         * for the first passes of the next run */
+        FOR(NB_DISPATCH_AND_ACC_BUFFER)
+        {
+            sem_wait(&acc_to_exec_sem);
         }
         if (LAST_RUN(dpu_offset)) {
             sem_post(&acc_to_process_sem);
         } else {
             sem_post(&accprocess_to_getreads_sem);
         }
-        FOR(NB_DISPATCH_AND_ACC_BUFFER)
-        {
-            sem_wait(&acc_to_exec_sem);
-        }
     }
     return NULL;
 }
@@ -161,6 +232,27 @@ void *thread_process(__attribute__((unused)) void *arg)
     return NULL;
 }
 
+/**
+ * @brief Open the PE1 or PE2 input file, either plain or gzip/BGZF compressed.
+ */
+static FILE *open_input_file(const char *input_prefix, const char *pe)
+{
+    static const char *extensions[] = { "fastq", "fastq.gz", "fq.gz" };
+    char filename[FILENAME_MAX];
+    FILE *f = NULL;
+
+    for (unsigned int each_extension = 0; each_extension < sizeof(extensions) / sizeof(extensions[0]); each_extension++) {
+        sprintf(filename, "%s_%s.%s", input_prefix, pe, extensions[each_extension]);
+        if ((f = fopen(filename, "r")) != NULL) {
+            printf("\tinput %s: %s\n", pe, filename);
+            return f;
+        }
+    }
+    sprintf(filename, "%s_%s.%s", input_prefix, pe, extensions[0]);
+    CHECK_FILE(f, filename);
+    return f;
+}
+
 static void exec_round()
 {
     char filename[FILENAME_MAX];
@@ -169,21 +261,25 @@ static void exec_round()
 
     if (round == 0) {
         size_t read_size1, read_size2, nb_read1, nb_read2;
+        int info1, info2;
 
-        sprintf(filename, "%s_PE1.fastq", input_prefix);
-        fipe1 = fopen(filename, "r");
-        CHECK_FILE(fipe1, filename);
-        assert(get_input_info(fipe1, &read_size1, &nb_read1) == 0);
-        assert(read_size1 == SIZE_READ);
+        fipe1 = open_input_file(input_prefix, "PE1");
+        info1 = get_input_info(fipe1, &read_size1, &nb_read1);
+        assert(info1 >= 0);
+        assert(info1 != 0 || read_size1 == index_get_size_read());
 
-        sprintf(filename, "%s_PE2.fastq", input_prefix);
-        fipe2 = fopen(filename, "r");
-        CHECK_FILE(fipe2, filename);
-        assert(get_input_info(fipe2, &read_size2, &nb_read2) == 0);
-        assert(read_size2 == SIZE_READ);
+        fipe2 = open_input_file(input_prefix, "PE2");
+        info2 = get_input_info(fipe2, &read_size2, &nb_read2);
+        assert(info2 >= 0);
+        assert(info2 != 0 || read_size2 == index_get_size_read());
 
-        assert(nb_read1 == nb_read2);
-        max_nb_pass = (unsigned int)(nb_read1 * 2 + nb_read2 * 2 + MAX_READS_BUFFER - 1) / MAX_READS_BUFFER;
+        if (info1 == 0 && info2 == 0) {
+            assert(nb_read1 == nb_read2);
+            max_nb_pass = (unsigned int)(nb_read1 * 2 + nb_read2 * 2 + MAX_READS_BUFFER - 1) / MAX_READS_BUFFER;
+        } else {
+            /* Reads from a pipe or a compressed file: the number of pass is only known at the end of the first run */
+            max_nb_pass = 0;
+        }
     } else {
         fipe1 = fope1;
         fipe2 = fope2;
@@ -203,6 +299,7 @@ static void exec_round()
         assert(unlink(filename) == 0);
     }
 
+    get_reads_init(fipe1, fipe2, mram_get_nb_dpu() > nb_dpus_per_run);
     accumulate_init(max_nb_pass);
 
     pthread_t tid_get_reads;
@@ -217,10 +314,13 @@ static void exec_round()
     assert(ret == 0);
     ret = sem_init(&dispatch_to_exec_sem, 0, 0);
     assert(ret == 0);
-    ret = sem_init(&exec_to_dispatch_sem, 0, 0);
-    assert(ret == 0);
-    ret = sem_init(&exec_to_acc_sem, 0, 0);
-    assert(ret == 0);
+    FOREACH_RANK(each_rank)
+    {
+        ret = sem_init(&exec_to_dispatch_sem[each_rank], 0, 0);
+        assert(ret == 0);
+        ret = sem_init(&exec_to_acc_sem[each_rank], 0, 0);
+        assert(ret == 0);
+    }
     ret = sem_init(&acc_to_exec_sem, 0, 0);
     assert(ret == 0);
     ret = sem_init(&acc_to_process_sem, 0, 0);
@@ -256,18 +356,22 @@ static void exec_round()
     assert(ret == 0);
     ret = sem_destroy(&dispatch_to_exec_sem);
     assert(ret == 0);
-    ret = sem_destroy(&exec_to_dispatch_sem);
-    assert(ret == 0);
+    FOREACH_RANK(each_rank)
+    {
+        ret = sem_destroy(&exec_to_dispatch_sem[each_rank]);
+        assert(ret == 0);
+        ret = sem_destroy(&exec_to_acc_sem[each_rank]);
+        assert(ret == 0);
+    }
     ret = sem_destroy(&acc_to_exec_sem);
     assert(ret == 0);
-    ret = sem_destroy(&exec_to_acc_sem);
-    assert(ret == 0);
     ret = sem_destroy(&acc_to_process_sem);
     assert(ret == 0);
     ret = sem_destroy(&accprocess_to_getreads_sem);
     assert(ret == 0);
 
     accumulate_free();
+    get_reads_free();
 
     fclose(fipe1);
     fclose(fipe2);
@@ -276,7 +380,7 @@ static void exec_round()
 static void do_mapping()
 {
     variant_tree_init();
-    backends_functions.init_backend(&nb_dpus_per_run);
+    backends_functions.init_backend(&nb_dpus_per_run, &nb_ranks_per_run);
     dispatch_init();
     process_read_init();
 
@@ -316,7 +420,6 @@ int main(int argc, char *argv[])
     print_time();
 
     printf("Information:\n");
-    printf("\tread size: %d\n", SIZE_READ);
     printf("\tseed size: %u\n", SIZE_SEED);
     struct timespec start_time, start_process_time, stop_time, stop_process_time;
     clock_gettime(CLOCK_MONOTONIC_RAW, &start_time);
@@ -327,12 +430,14 @@ int main(int argc, char *argv[])
         backends_functions.free_backend = free_backend_simulation;
         backends_functions.run_dpu = run_dpu_simulation;
         backends_functions.load_mram = load_mram_simulation;
+        backends_functions.select_mram = select_mram_simulation;
         backends_functions.wait_dpu = wait_dpu_simulation;
     } else {
         backends_functions.init_backend = init_backend_dpu;
         backends_functions.free_backend = free_backend_dpu;
         backends_functions.run_dpu = run_on_dpu;
         backends_functions.load_mram = load_mram_dpu;
+        backends_functions.select_mram = select_mram_dpu;
         backends_functions.wait_dpu = wait_dpu_dpu;
     }
 
@@ -347,6 +452,10 @@ int main(int argc, char *argv[])
         index_load();
         do_mapping();
         break;
+    case goal_bench:
+        index_load();
+        index_bench();
+        break;
     case goal_unknown:
     default:
         ERROR_EXIT(ERR_NO_GOAL_DEFINED, "goal has not been specified!");
@@ -10,6 +10,7 @@
 
 #include "common.h"
 #include "genome.h"
+#include "index.h"
 #include "parse_args.h"
 #include "upvc.h"
 #include "vartree.h"
@@ -69,8 +70,7 @@ typedef struct {
     uint32_t score;
 } depth_filter_t;
 
-#if (SIZE_READ == 120)
-depth_filter_t sub_filter[] = {
+static const depth_filter_t sub_filter_120[] = {
     [3] = { 15, 16 },
     [4] = { 17, 17 },
     [5] = { 18, 18 },
@@ -91,7 +91,7 @@ depth_filter_t sub_filter[] = {
     [20] = { 40, 25 },
 };
 
-depth_filter_t indel_filter[] = {
+static const depth_filter_t indel_filter_120[] = {
     [2] = { 10, 16 },
     [3] = { 12, 21 },
     [4] = { 13, 21 },
@@ -103,8 +103,7 @@ depth_filter_t indel_filter[] = {
     [10] = { 1, 30 },
     [11] = { 1, 40 },
 };
-#elif (SIZE_READ == 150)
-depth_filter_t sub_filter[] = {
+static const depth_filter_t sub_filter_150[] = {
     [3] = { 15, 16 },
     [4] = { 17, 20 },
     [5] = { 18, 20 },
@@ -125,7 +124,7 @@ depth_filter_t sub_filter[] = {
     [20] = { 40, 29 },
 };
 
-depth_filter_t indel_filter[] = {
+static const depth_filter_t indel_filter_150[] = {
     [2] = { 9, 21 },
     [3] = { 12, 22 },
     [4] = { 12, 22 },
@@ -137,12 +136,27 @@ depth_filter_t indel_filter[] = {
     [10] = { 1, 27 },
     [11] = { 1, 40 },
 };
-#else
-#error "Filter not defined for this size of read"
-#endif
+static const depth_filter_t *sub_filter;
+static const depth_filter_t *indel_filter;
 
-static bool homopolymer(int8_t *seq, int offset)
+#define SELECT_FILTERS_CASE(size_read, unused)                                                                                   \
+    case size_read:                                                                                                              \
+        sub_filter = sub_filter_##size_read;                                                                                     \
+        indel_filter = indel_filter_##size_read;                                                                                 \
+        break;
+static void select_filters(unsigned int size_read)
 {
+    switch (size_read) {
+        FOREACH_SIZE_READ(SELECT_FILTERS_CASE, )
+    default:
+        ERROR_EXIT(ERR_SIZE_READ_NOT_SUPPORTED, "%s: no filter for reads of %u symbols", __func__, size_read);
+    }
+}
+
+static bool homopolymer(genome_t *ref_genome, uint64_t genome_pos, int offset)
+{
+    int8_t seq[offset];
+    genome_get_bases(ref_genome, genome_pos, offset, seq);
     for (int i = 0; i < offset - 1; i++) {
         if (seq[i] != seq[i + 1]) {
             return false;
@@ -165,7 +179,7 @@ static bool print_variant_tree(variant_t *var, uint32_t seq_nr, uint64_t seq_pos
 
     uint32_t ref_len = strlen(var->ref);
     uint32_t alt_len = strlen(var->alt);
-    if (ref_len > alt_len && percentage <= 25 && homopolymer(&ref_genome->data[genome_pos - 12], 12)) {
+    if (ref_len > alt_len && percentage <= 25 && homopolymer(ref_genome, genome_pos - 12, 12)) {
         return false;
     }
 
@@ -209,6 +223,8 @@ void create_vcf()
     char filename[1024];
     genome_t *ref_genome = genome_get();
 
+    select_filters(index_get_size_read());
+
     sprintf(filename, "%s_upvc.vcf", get_input_path());
     vcf_file = fopen(filename, "w");
     CHECK_FILE(vcf_file, filename);